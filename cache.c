@@ -0,0 +1,225 @@
+#include "xjob.h"
+#include <linux/hash.h>
+#include <linux/moduleparam.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#define CACHE_HASH_BITS 8
+
+/* checksum results of unchanged infiles, least recently used dropped */
+static unsigned int cache_size = 1024;
+module_param(cache_size, uint, 0644);
+MODULE_PARM_DESC(cache_size, "checksum results to cache, 0 disables it");
+
+/* one digest, keyed by sb, dev, ino, algo and flags */
+struct cache_ent {
+	struct hlist_node hash;
+	struct list_head lru;
+	struct file_stamp stamp;	/* of the infile when it was hashed */
+	unsigned int algo;
+	unsigned int flags;
+	u8 digest[SHA256_HASH_SIZE];
+};
+
+static struct hlist_head cache_table[1 << CACHE_HASH_BITS];
+static LIST_HEAD(cache_lru);		/* most recently used first */
+static DEFINE_SPINLOCK(cache_lock);	/* protect all of the above */
+static unsigned int cache_len;
+static unsigned long cache_hits;
+static unsigned long cache_misses;
+static unsigned long cache_evictions;
+static unsigned long cache_stale;	/* infile changed since hashed */
+static unsigned long cache_racy;	/* not cached, changed too recently */
+
+/* a change within the same timestamp granule as the last one, at the
+ * same size, leaves the stamp as it is. i_version does not help unless
+ * the fs is mounted with it, so as git does with racy index entries, a
+ * stamp taken that close to the last change is not cached. the fs clock
+ * is coarse, so the granule is never taken below 1 s */
+static bool stamp_racy(struct inode *inode, struct file_stamp *stamp)
+{
+	struct timespec now = current_fs_time(inode->i_sb);
+	s64 gran = max_t(s64, inode->i_sb->s_time_gran, NSEC_PER_SEC);
+
+	return timespec_to_ns(&now) - timespec_to_ns(&stamp->mtime) < gran ||
+		timespec_to_ns(&now) - timespec_to_ns(&stamp->ctime) < gran;
+}
+
+/* false for files whose content is not tied to their inode */
+bool get_file_stamp(struct inode *inode, struct file_stamp *stamp)
+{
+	if (!S_ISREG(inode->i_mode))
+		return false;
+
+	stamp->sb = inode->i_sb;
+	stamp->dev = inode->i_sb->s_dev;
+	stamp->ino = inode->i_ino;
+	stamp->generation = inode->i_generation;
+	stamp->size = i_size_read(inode);
+	stamp->mtime = inode->i_mtime;
+	stamp->ctime = inode->i_ctime;
+	stamp->version = inode->i_version;
+	stamp->racy = stamp_racy(inode, stamp);
+
+	return true;
+}
+
+/* i_version only moves on fs mounted with it, mtime and ctime always */
+static bool stamp_equal(struct file_stamp *a, struct file_stamp *b)
+{
+	return a->generation == b->generation && a->size == b->size &&
+		timespec_equal(&a->mtime, &b->mtime) &&
+		timespec_equal(&a->ctime, &b->ctime) &&
+		a->version == b->version;
+}
+
+static struct hlist_head *cache_bucket(struct file_stamp *stamp)
+{
+	return &cache_table[hash_long((unsigned long)stamp->sb ^ stamp->ino,
+				      CACHE_HASH_BITS)];
+}
+
+/* grab cache_lock first */
+static struct cache_ent *cache_find(struct file_stamp *stamp,
+				    unsigned int algo, unsigned int flags)
+{
+	struct cache_ent *ent;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(ent, node, cache_bucket(stamp), hash) {
+		if (ent->stamp.sb == stamp->sb &&
+		    ent->stamp.dev == stamp->dev &&
+		    ent->stamp.ino == stamp->ino &&
+		    ent->algo == algo && ent->flags == flags)
+			return ent;
+	}
+
+	return NULL;
+}
+
+static void cache_drop(struct cache_ent *ent)
+{
+	hlist_del(&ent->hash);
+	list_del(&ent->lru);
+	cache_len--;
+	kfree(ent);
+}
+
+/* fill hash if the infile has not changed since it was last hashed */
+bool cache_lookup(struct file_stamp *stamp, unsigned int algo,
+		  unsigned int flags, u8 *hash)
+{
+	struct cache_ent *ent;
+	bool hit = false;
+
+	if (!cache_size)
+		return false;
+
+	spin_lock(&cache_lock);
+	ent = cache_find(stamp, algo, flags);
+	if (ent && stamp_equal(&ent->stamp, stamp)) {
+		memcpy(hash, ent->digest, get_hash_size(algo));
+		list_move(&ent->lru, &cache_lru);
+		hit = true;
+		cache_hits++;
+	} else {
+		if (ent) {
+			cache_drop(ent);
+			cache_stale++;
+		}
+		cache_misses++;
+	}
+	spin_unlock(&cache_lock);
+
+	return hit;
+}
+
+/* stamp is taken before hashing: if the infile changes meanwhile, the
+ * entry will not match it anymore, unless the stamp is racy */
+void cache_insert(struct file_stamp *stamp, unsigned int algo,
+		  unsigned int flags, const u8 *hash)
+{
+	struct cache_ent *ent;
+	struct cache_ent *old;
+
+	if (stamp->racy) {
+		spin_lock(&cache_lock);
+		cache_racy++;
+		spin_unlock(&cache_lock);
+		return;
+	}
+
+	ent = kmalloc(sizeof(struct cache_ent), GFP_KERNEL);
+	if (!ent)
+		return;
+	ent->stamp = *stamp;
+	ent->algo = algo;
+	ent->flags = flags;
+	memcpy(ent->digest, hash, get_hash_size(algo));
+
+	spin_lock(&cache_lock);
+	old = cache_find(stamp, algo, flags);
+	if (old)
+		cache_drop(old);
+	hlist_add_head(&ent->hash, cache_bucket(stamp));
+	list_add(&ent->lru, &cache_lru);
+	cache_len++;
+
+	/* cache_size may have been lowered since */
+	while (cache_len > cache_size) {
+		cache_drop(list_entry(cache_lru.prev, struct cache_ent, lru));
+		cache_evictions++;
+	}
+	spin_unlock(&cache_lock);
+}
+
+static int cache_show(struct seq_file *m, void *v)
+{
+	spin_lock(&cache_lock);
+	seq_printf(m, "entries: %u/%u\n", cache_len, cache_size);
+	seq_printf(m, "hits: %lu\n", cache_hits);
+	seq_printf(m, "misses: %lu\n", cache_misses);
+	seq_printf(m, "stale: %lu\n", cache_stale);
+	seq_printf(m, "racy: %lu\n", cache_racy);
+	seq_printf(m, "evictions: %lu\n", cache_evictions);
+	spin_unlock(&cache_lock);
+
+	return 0;
+}
+
+static int cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cache_show, NULL);
+}
+
+static const struct file_operations cache_fops = {
+	.owner = THIS_MODULE,
+	.open = cache_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int init_cache(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache_table); i++)
+		INIT_HLIST_HEAD(&cache_table[i]);
+
+	/* /proc/xjob/cache */
+	if (!proc_create("cache", 0444, proc_xjob, &cache_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+void destroy_cache(void)
+{
+	struct cache_ent *ent, *tmp;
+
+	remove_proc_entry("cache", proc_xjob);
+
+	list_for_each_entry_safe(ent, tmp, &cache_lru, lru)
+		cache_drop(ent);
+}
@@ -1,5 +1,29 @@
 #define MD5_HASH_SIZE 16
 #define SHA1_HASH_SIZE 20
+#define SHA256_HASH_SIZE 32
+#define JOB_BATCH_MAX 256 /* max jobs per ACTION_SUBMIT_BATCH */
+#define RING_MAX_ENTRIES 4096
+#define RING_PATH_LEN 1024 /* infile and outfile of a sqe */
+#define RING_NEED_WAKEUP 1 /* sq_flags: poller sleeps, ACTION_RING_ENTER */
+
+/* xargs.flags */
+#define XJOB_F_CQ 0x1 /* report completion to cq_fd instead of SIGUSR1 */
+#define XJOB_F_TREE 0x2 /* checksum: tree digest, also per jobdesc/sqe */
+#define XJOB_F_DECOMPRESS 0x4 /* compress: undo it, also per jobdesc/sqe */
+#define XJOB_F_ALGO_MASK 0x8 /* checksum: algo is a mask of ALGO_BIT()s */
+/* checksum: no outfile, the raw digests are returned in the jobres */
+#define XJOB_F_NO_OUTFILE 0x40
+#define XJOB_F_JOB (XJOB_F_TREE | XJOB_F_DECOMPRESS | XJOB_F_ALGO_MASK | \
+		    XJOB_F_NO_OUTFILE)
+/* submit, when the queue is full: fail with -EAGAIN instead of waiting */
+#define XJOB_F_NONBLOCK 0x10
+/* submit: any signal ends the wait with -EINTR, not only a fatal one */
+#define XJOB_F_INTR 0x20
+
+/* tree digest: the infile is cut in leaves of 1 << TREE_LEAF_SHIFT bytes,
+ * root = H(H(leaf 0) || H(leaf 1) || ... ), H of nothing for empty files */
+#define TREE_LEAF_SHIFT 22
+#define TREE_LEAF_SIZE (1ULL << TREE_LEAF_SHIFT)
 
 enum job_action_class {
 	ACTION_SETUP = 0,
@@ -7,9 +31,25 @@ enum job_action_class {
 	ACTION_LIST,
 	ACTION_REMOVE_ONE,
 	ACTION_REMOVE_ALL,
+	ACTION_SUBMIT_BATCH,
+	ACTION_RING_SETUP,
+	ACTION_RING_ENTER,
+	ACTION_CQ_SETUP,
+	ACTION_STATUS,
 	ACTION_LAST,
 };
 
+enum job_state_class {
+	STATE_NEW,
+	STATE_PENDING,
+	STATE_PROCESSING,
+	STATE_SUCCESS,
+	STATE_ABORTE,
+	STATE_FAILED,
+};
+
+#define STATE_BIT(state) (1U << (state))
+
 enum job_category_class {
 	CATEGORY_UNDEFINED = 0,
 	CATEGORY_CHECKSUM,
@@ -21,9 +61,40 @@ enum job_algorithm_class {
 	ALGORITHM_UNDEFINED = 0,
 	ALGORITHM_MD5,
 	ALGORITHM_SHA1,
+	ALGORITHM_SHA256,
+	ALGORITHM_DEFLATE,	/* compress, level 1-9 */
+	ALGORITHM_LZO,		/* compress, if the kernel has lzo */
 	ALGORITHM_LAST,
 };
 
+/* XJOB_F_ALGO_MASK: one read, a digest line per algorithm */
+#define ALGO_BIT(algo) (1U << (algo))
+#define ALGO_HASH_MASK (ALGO_BIT(ALGORITHM_MD5) | ALGO_BIT(ALGORITHM_SHA1) | \
+			ALGO_BIT(ALGORITHM_SHA256))
+#define HASH_ALL_SIZE (MD5_HASH_SIZE + SHA1_HASH_SIZE + SHA256_HASH_SIZE)
+
+/* consumers drain higher classes first, queued jobs slowly age up */
+enum job_priority_class {
+	PRIORITY_DEFAULT = 0,	/* PRIORITY_NORMAL */
+	PRIORITY_LOW,
+	PRIORITY_NORMAL,
+	PRIORITY_HIGH,
+	PRIORITY_LAST,
+};
+
+static inline char *get_priority_name(enum job_priority_class priority)
+{
+	static char *names[] = {"", "low", "normal", "high", ""};
+	return names[priority];
+}
+
+static inline char *get_state_name(enum job_state_class state)
+{
+	static char *names[] = {"new", "pending", "processing", "success",
+				"aborted", "failed"};
+	return names[state];
+}
+
 static inline char *get_category_name(enum job_category_class category)
 {
 	static char *names[] = {"UNDEFINED", "CHECKSUM",
@@ -33,13 +104,15 @@ static inline char *get_category_name(enum job_category_class category)
 
 static inline char *get_algo_name(enum job_algorithm_class algo)
 {
-	static char *names[] = {"", "md5", "sha1", ""};
+	static char *names[] = {"", "md5", "sha1", "sha256", "deflate",
+				"lzo", ""};
 	return names[algo];
 }
 
 static inline int get_hash_size(enum job_algorithm_class algo)
 {
-	static const int size[] = {0, MD5_HASH_SIZE, SHA1_HASH_SIZE, 0};
+	static const int size[] = {0, MD5_HASH_SIZE, SHA1_HASH_SIZE,
+					SHA256_HASH_SIZE, 0, 0, 0};
 	return size[algo];
 }
 
@@ -52,10 +125,94 @@ struct jobent {
 	int id;
 	pid_t pid;
 	unsigned int category;
+	unsigned int priority;
+	int state;
 	unsigned int name_len; /* length of infile, may truncated to NAME_MAX */
 	char infile[NAME_MAX+1]; /* null terminated */
 };
 
+/* ACTION_LIST: which jobs, 0 for any */
+struct jobfilter {
+	pid_t pid;
+	unsigned int category;
+	unsigned int states;	/* STATE_BIT()s, 0 for pending jobs only */
+};
+
+/* one job of ACTION_SUBMIT_BATCH, id and err are filled by the kernel */
+struct jobdesc {
+	int id;
+	int err;
+	unsigned int category;
+	unsigned int algo;
+	unsigned int oflags;
+	unsigned int flags;		/* XJOB_F_JOB */
+	int level;			/* compress, 0 for the default */
+	unsigned int priority;
+	__user const char *infile;	/* should be absolute path */
+	__user const char *outfile;	/* absolute, NULL if XJOB_F_NO_OUTFILE */
+};
+
+/* ACTION_RING_SETUP, tells how to mmap the rings from the returned fd */
+struct ring_params {
+	unsigned int sq_entries;	/* in, rounded up to a power of 2 */
+	unsigned int sq_idle_ms;	/* in, poller sleeps when idle this long */
+	unsigned int cq_entries;	/* out, twice sq_entries */
+	unsigned int map_size;		/* out, bytes to mmap at offset 0 */
+	unsigned int sq_off;		/* out, offset of the sqe array */
+	unsigned int cq_off;		/* out, offset of the cqe array */
+};
+
+/* head of the shared mapping. the client moves sq_tail and cq_head,
+ * the kernel moves sq_head and cq_tail. indexes are free running */
+struct xjob_rings {
+	unsigned int sq_head;
+	unsigned int sq_tail;
+	unsigned int sq_flags;
+	unsigned int sq_entries;
+	unsigned int cq_head;
+	unsigned int cq_tail;
+	unsigned int cq_entries;
+};
+
+/* submission queue entry */
+struct xjob_sqe {
+	unsigned long long user_data;	/* copied to the cqe */
+	unsigned int category;
+	unsigned int algo;
+	unsigned int oflags;
+	unsigned int flags;		/* XJOB_F_JOB */
+	int level;
+	unsigned int priority;
+	char paths[RING_PATH_LEN];	/* "infile\0outfile\0", absolute */
+};
+
+/* completion record, read() in bulk from an ACTION_CQ_SETUP fd */
+struct jobres {
+	int id;
+	int err;			/* 0 or negative errno */
+	unsigned long long bytes;	/* of infile processed */
+	unsigned long long nsecs;	/* from submit to completion */
+	unsigned int hash_len;		/* checksum: bytes of hash, 0 if none */
+	unsigned char hash[HASH_ALL_SIZE]; /* digests, in algorithm order */
+};
+
+/* ACTION_STATUS, of a live or recently finished job */
+struct jobstatus {
+	int id;
+	int state;			/* enum job_state_class */
+	int err;			/* once finished */
+	unsigned long long bytes;	/* of infile processed so far */
+	unsigned long long size;	/* of infile, 0 if unknown */
+	unsigned int hash_len;		/* as in struct jobres */
+	unsigned char hash[HASH_ALL_SIZE];
+};
+
+/* completion queue entry */
+struct xjob_cqe {
+	unsigned long long user_data;
+	struct jobres res;
+};
+
 struct xargs {
 	int id;
 	unsigned int action;
@@ -63,8 +220,22 @@ struct xargs {
 	unsigned int algo;
 	unsigned int oflags;
 	__user const char *infile;	/* should be absolute path */
-	__user const char *outfile;	/* should be absolute path */
+	__user const char *outfile;	/* absolute, NULL if XJOB_F_NO_OUTFILE */
 	__user struct jobent *list_buf;
 	unsigned int list_len;
+	/* ACTION_LIST: jobs from this id on. a short list ends them,
+	 * else go on from the last id listed + 1 */
+	unsigned int list_cursor;
+	struct jobfilter filter;
+	__user struct jobdesc *batch_buf;
+	unsigned int batch_len;
+	__user struct ring_params *ring_params;
+	int ring_fd;
+	unsigned int flags;
+	int cq_fd;	/* ACTION_CQ_SETUP fd or an eventfd, XJOB_F_CQ */
+	int level;	/* compression level, 0 for the default */
+	unsigned int priority;
+	unsigned int timeout_ms; /* submit: wait for queue room, 0 forever */
+	__user struct jobstatus *status_buf; /* ACTION_STATUS of id */
 };
 
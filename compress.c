@@ -0,0 +1,382 @@
+#include "xjob.h"
+#include <linux/vmalloc.h>
+#include <linux/zlib.h>
+#include <linux/lzo.h>
+
+#define COMP_BLOCK_SIZE (128 * 1024) /* infile bytes per frame */
+#define COMP_OUT_SIZE lzo1x_worst_compress(COMP_BLOCK_SIZE)
+#define COMP_MAGIC "XJZ1"
+
+/* compressed file: a comp_header, then frames of a comp_frame followed by
+ * clen bytes, each block compressed on its own. clen == len means the
+ * block is stored as is. a frame of zeros ends the file */
+struct comp_header {
+	char magic[4];
+	u8 algo;
+	u8 level;
+	__le16 reserved;
+	__le32 block_size;
+};
+
+struct comp_frame {
+	__le32 clen;
+	__le32 len;
+};
+
+struct codec {
+	int algo;
+	bool decompress;
+	z_stream strm;
+	void *wrkmem;			/* lzo */
+};
+
+/* -EINVAL if algo is no compression algorithm, -ENOTSUPP if this
+ * kernel is built without it */
+int codec_supported(unsigned int algo, bool decompress)
+{
+	if (algo == ALGORITHM_DEFLATE)
+		return 0;
+	if (algo != ALGORITHM_LZO)
+		return -EINVAL;
+	if (decompress ? !IS_ENABLED(CONFIG_LZO_DECOMPRESS) :
+	    !IS_ENABLED(CONFIG_LZO_COMPRESS))
+		return -ENOTSUPP;
+
+	return 0;
+}
+
+static int init_codec(struct codec *c, int algo, int level, bool decompress)
+{
+	int ret;
+
+	c->algo = algo;
+	c->decompress = decompress;
+	c->strm.workspace = NULL;
+	c->wrkmem = NULL;
+
+	ret = codec_supported(algo, decompress);
+	if (ret)
+		return ret;
+
+	if (algo == ALGORITHM_LZO) {
+#if IS_ENABLED(CONFIG_LZO_COMPRESS)
+		if (!decompress) {
+			c->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+			if (!c->wrkmem)
+				return -ENOMEM;
+		}
+#endif
+		return 0;
+	}
+
+	/* raw deflate, the frames carry the lengths */
+	if (decompress) {
+		c->strm.workspace = vmalloc(zlib_inflate_workspacesize());
+		if (!c->strm.workspace)
+			return -ENOMEM;
+		ret = zlib_inflateInit2(&c->strm, -MAX_WBITS);
+	} else {
+		c->strm.workspace = vmalloc(zlib_deflate_workspacesize(
+					    MAX_WBITS, MAX_MEM_LEVEL));
+		if (!c->strm.workspace)
+			return -ENOMEM;
+		ret = zlib_deflateInit2(&c->strm, level ? level :
+					Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+					-MAX_WBITS, MAX_MEM_LEVEL,
+					Z_DEFAULT_STRATEGY);
+	}
+	if (ret != Z_OK) {
+		vfree(c->strm.workspace);
+		c->strm.workspace = NULL;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void destroy_codec(struct codec *c)
+{
+	if (c->strm.workspace) {
+		if (c->decompress)
+			zlib_inflateEnd(&c->strm);
+		else
+			zlib_deflateEnd(&c->strm);
+		vfree(c->strm.workspace);
+	}
+	vfree(c->wrkmem);
+}
+
+/* *clen is len when the block does not shrink, and is to be stored */
+static int compress_block(struct codec *c, u8 *in, unsigned int len,
+			  u8 *out, unsigned int *clen)
+{
+	size_t out_len = COMP_OUT_SIZE;
+
+	*clen = len;
+	if (c->algo == ALGORITHM_LZO) {
+#if IS_ENABLED(CONFIG_LZO_COMPRESS)
+		if (lzo1x_1_compress(in, len, out, &out_len, c->wrkmem) !=
+		    LZO_E_OK)
+			return -EIO;
+		if (out_len < len)
+			*clen = out_len;
+		return 0;
+#else
+		return -ENOTSUPP;
+#endif
+	}
+
+	if (zlib_deflateReset(&c->strm) != Z_OK)
+		return -EIO;
+	c->strm.next_in = in;
+	c->strm.avail_in = len;
+	c->strm.next_out = out;
+	c->strm.avail_out = len;
+	/* anything but Z_STREAM_END: it does not fit in len bytes */
+	if (zlib_deflate(&c->strm, Z_FINISH) == Z_STREAM_END &&
+	    c->strm.total_out < len)
+		*clen = c->strm.total_out;
+
+	return 0;
+}
+
+static int decompress_block(struct codec *c, u8 *in, unsigned int clen,
+			    u8 *out, unsigned int len)
+{
+	size_t out_len = len;
+
+	if (c->algo == ALGORITHM_LZO) {
+#if IS_ENABLED(CONFIG_LZO_DECOMPRESS)
+		if (lzo1x_decompress_safe(in, clen, out, &out_len) !=
+		    LZO_E_OK || out_len != len)
+			return -EINVAL;
+		return 0;
+#else
+		return -ENOTSUPP;
+#endif
+	}
+
+	if (zlib_inflateReset(&c->strm) != Z_OK)
+		return -EIO;
+	c->strm.next_in = in;
+	c->strm.avail_in = clen;
+	c->strm.next_out = out;
+	c->strm.avail_out = len;
+	if (zlib_inflate(&c->strm, Z_FINISH) != Z_STREAM_END ||
+	    c->strm.total_out != len)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* read len bytes unless the file ends first, return the bytes read */
+static ssize_t read_full(struct file *file, void *buf, size_t len)
+{
+	mm_segment_t old_fs;
+	ssize_t bytes = 0;
+	size_t done = 0;
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	while (done < len) {
+		bytes = vfs_read(file, (__user char *)buf + done, len - done,
+				 &file->f_pos);
+		if (bytes <= 0)
+			break;
+		done += bytes;
+	}
+	set_fs(old_fs);
+
+	return bytes < 0 ? bytes : done;
+}
+
+static int write_full(struct file *file, void *buf, size_t len)
+{
+	mm_segment_t old_fs;
+	ssize_t bytes;
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	bytes = vfs_write(file, (__user char *)buf, len, &file->f_pos);
+	set_fs(old_fs);
+
+	if (bytes < 0)
+		return bytes;
+	if (bytes != len)
+		return -EIO;
+
+	return 0;
+}
+
+static int compress_file(struct job *job, struct file *src,
+			 struct file *dst, u8 *in, u8 *out)
+{
+	struct comp_header hdr;
+	struct comp_frame frame;
+	struct codec c;
+	unsigned int clen;
+	ssize_t len;
+	int err;
+
+	if (job->level < 0 || job->level > Z_BEST_COMPRESSION)
+		return -EINVAL;
+
+	err = init_codec(&c, job->algo, job->level, false);
+	if (err)
+		return err;
+
+	memcpy(hdr.magic, COMP_MAGIC, sizeof(hdr.magic));
+	hdr.algo = job->algo;
+	hdr.level = job->level;
+	hdr.reserved = 0;
+	hdr.block_size = cpu_to_le32(COMP_BLOCK_SIZE);
+	err = write_full(dst, &hdr, sizeof(hdr));
+
+	while (!err) {
+		if (ACCESS_ONCE(job->cancel)) {
+			err = -ECANCELED;
+			break;
+		}
+		len = read_full(src, in, COMP_BLOCK_SIZE);
+		if (len <= 0) {
+			err = len;
+			break;
+		}
+		job->bytes += len;
+
+		err = compress_block(&c, in, len, out, &clen);
+		if (err)
+			break;
+		frame.clen = cpu_to_le32(clen);
+		frame.len = cpu_to_le32(len);
+		err = write_full(dst, &frame, sizeof(frame));
+		if (!err)
+			err = write_full(dst, clen < len ? out : in, clen);
+	}
+
+	/* end of file */
+	if (!err) {
+		memset(&frame, 0, sizeof(frame));
+		err = write_full(dst, &frame, sizeof(frame));
+	}
+
+	destroy_codec(&c);
+
+	return err;
+}
+
+static int decompress_file(struct job *job, struct file *src,
+			   struct file *dst, u8 *in, u8 *out)
+{
+	struct comp_header hdr;
+	struct comp_frame frame;
+	struct codec c;
+	unsigned int clen, len;
+	ssize_t bytes;
+	int err;
+
+	bytes = read_full(src, &hdr, sizeof(hdr));
+	if (bytes < 0)
+		return bytes;
+	if (bytes != sizeof(hdr) ||
+	    memcmp(hdr.magic, COMP_MAGIC, sizeof(hdr.magic)) ||
+	    le32_to_cpu(hdr.block_size) > COMP_BLOCK_SIZE) {
+		INFO("%s: not compressed by xjob", job->infile);
+		return -EINVAL;
+	}
+
+	/* the header tells the algorithm, not the job */
+	err = init_codec(&c, hdr.algo, 0, true);
+	if (err)
+		return err;
+
+	while (!err) {
+		if (ACCESS_ONCE(job->cancel)) {
+			err = -ECANCELED;
+			break;
+		}
+		bytes = read_full(src, &frame, sizeof(frame));
+		if (bytes != sizeof(frame)) {
+			err = bytes < 0 ? bytes : -EINVAL; /* truncated */
+			break;
+		}
+		clen = le32_to_cpu(frame.clen);
+		len = le32_to_cpu(frame.len);
+		if (!clen && !len)
+			break;
+		if (len > COMP_BLOCK_SIZE || clen > len) {
+			err = -EINVAL;
+			break;
+		}
+
+		bytes = read_full(src, out, clen);
+		if (bytes != clen) {
+			err = bytes < 0 ? bytes : -EINVAL;
+			break;
+		}
+		job->bytes += sizeof(frame) + clen;
+
+		if (clen == len) {
+			err = write_full(dst, out, len);
+			continue;
+		}
+		err = decompress_block(&c, out, clen, in, len);
+		if (!err)
+			err = write_full(dst, in, len);
+	}
+
+	destroy_codec(&c);
+
+	return err;
+}
+
+int compress(struct job *job)
+{
+	struct file *src = NULL;
+	struct file *dst = NULL;
+	ktime_t start = ktime_get();
+	u8 *in = NULL;
+	u8 *out = NULL;
+	int err;
+
+	src = filp_open(job->infile, O_RDONLY, 0);
+	if (IS_ERR(src)) {
+		INFO("Error opening infile '%s'", job->infile);
+		err = PTR_ERR(src);
+		goto out;
+	}
+	dst = filp_open(job->outfile,
+			job->oflags | O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (IS_ERR(dst)) {
+		INFO("Error opening outfile '%s'", job->outfile);
+		err = PTR_ERR(dst);
+		goto out;
+	}
+
+	in = vmalloc(COMP_BLOCK_SIZE);
+	out = vmalloc(COMP_OUT_SIZE);
+	if (!in || !out) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (job->flags & XJOB_F_DECOMPRESS)
+		err = decompress_file(job, src, dst, in, out);
+	else
+		err = compress_file(job, src, dst, in, out);
+	if (!err)
+		pr_debug("%s: %s %llu bytes in %lld us\n", job->infile,
+		     job->flags & XJOB_F_DECOMPRESS ? "decompressed" :
+		     "compressed", job->bytes,
+		     ktime_to_us(ktime_sub(ktime_get(), start)));
+
+out:
+	if (src && !IS_ERR(src))
+		filp_close(src, NULL);
+	if (dst && !IS_ERR(dst))
+		filp_close(dst, NULL);
+	vfree(in);
+	vfree(out);
+
+	return err;
+}
@@ -0,0 +1,208 @@
+#include "xjob.h"
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+
+/* completion queue fd: jobs submitted with XJOB_F_CQ post a jobres here
+ * instead of signaling their submitter, read() drains them in bulk */
+struct xcq {
+	struct kref ref;		/* the fd and every bound job */
+	spinlock_t lock;		/* protect recs */
+	struct list_head recs;
+	wait_queue_head_t wait;
+};
+
+struct cq_rec {
+	struct list_head list;
+	struct jobres res;
+};
+
+static const struct file_operations cq_fops;
+
+static void cq_free(struct kref *ref)
+{
+	struct xcq *cq = container_of(ref, struct xcq, ref);
+	struct cq_rec *rec, *tmp;
+
+	list_for_each_entry_safe(rec, tmp, &cq->recs, list)
+		kfree(rec);
+	kfree(cq);
+}
+
+void cq_complete(struct job *job, int err)
+{
+	struct xcq *cq = job->cq;
+	struct cq_rec *rec;
+
+	if (job->efd)
+		eventfd_signal(job->efd, 1);
+	if (!cq)
+		return;
+
+	/* from cq_bind(), so completion cannot fail */
+	rec = job->cq_rec;
+	job->cq_rec = NULL;
+	fill_jobres(job, err, &rec->res);
+
+	spin_lock(&cq->lock);
+	list_add_tail(&rec->list, &cq->recs);
+	spin_unlock(&cq->lock);
+
+	wake_up_interruptible(&cq->wait);
+}
+
+static ssize_t cq_read(struct file *file, char __user *buf, size_t count,
+		       loff_t *ppos)
+{
+	struct xcq *cq = file->private_data;
+	struct cq_rec *rec;
+	ssize_t done = 0;
+	int err;
+
+	if (count < sizeof(struct jobres))
+		return -EINVAL;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		err = wait_event_interruptible(cq->wait,
+					       !list_empty(&cq->recs));
+		if (err)
+			return err;
+	}
+
+	while (count - done >= sizeof(struct jobres)) {
+		spin_lock(&cq->lock);
+		if (list_empty(&cq->recs)) {
+			spin_unlock(&cq->lock);
+			break;
+		}
+		rec = list_first_entry(&cq->recs, struct cq_rec, list);
+		list_del(&rec->list);
+		spin_unlock(&cq->lock);
+
+		if (copy_to_user(buf + done, &rec->res,
+				 sizeof(struct jobres))) {
+			/* put it back, do not lose the record */
+			spin_lock(&cq->lock);
+			list_add(&rec->list, &cq->recs);
+			spin_unlock(&cq->lock);
+			return done ? done : -EFAULT;
+		}
+		kfree(rec);
+		done += sizeof(struct jobres);
+	}
+
+	return done ? done : -EAGAIN;
+}
+
+static unsigned int cq_poll(struct file *file, poll_table *wait)
+{
+	struct xcq *cq = file->private_data;
+
+	poll_wait(file, &cq->wait, wait);
+	if (!list_empty(&cq->recs))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+static int cq_file_release(struct inode *inode, struct file *file)
+{
+	struct xcq *cq = file->private_data;
+
+	kref_put(&cq->ref, cq_free);
+
+	return 0;
+}
+
+static const struct file_operations cq_fops = {
+	.owner = THIS_MODULE,
+	.read = cq_read,
+	.poll = cq_poll,
+	.release = cq_file_release,
+	.llseek = noop_llseek,
+};
+
+/* On success the cq fd is returned */
+int cq_setup(void)
+{
+	struct xcq *cq;
+	int fd;
+
+	cq = kmalloc(sizeof(struct xcq), GFP_KERNEL);
+	if (!cq)
+		return -ENOMEM;
+
+	kref_init(&cq->ref);
+	spin_lock_init(&cq->lock);
+	INIT_LIST_HEAD(&cq->recs);
+	init_waitqueue_head(&cq->wait);
+
+	fd = anon_inode_getfd("[xjob_cq]", &cq_fops, cq, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		kfree(cq);
+
+	return fd;
+}
+
+/* resolve the cq_fd of a submission: a cq fd, or any eventfd which is
+ * signaled once per completion */
+int cq_get(int fd, struct xcq **cqp, struct eventfd_ctx **efdp)
+{
+	struct file *file;
+	struct eventfd_ctx *efd;
+
+	*cqp = NULL;
+	*efdp = NULL;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	if (file->f_op == &cq_fops) {
+		*cqp = file->private_data;
+		kref_get(&(*cqp)->ref);
+	} else {
+		efd = eventfd_ctx_fileget(file);
+		if (IS_ERR(efd)) {
+			fput(file);
+			return -EINVAL;
+		}
+		*efdp = efd;
+	}
+	fput(file);
+
+	return 0;
+}
+
+void cq_release(struct xcq *cq, struct eventfd_ctx *efd)
+{
+	if (cq)
+		kref_put(&cq->ref, cq_free);
+	if (efd)
+		eventfd_ctx_put(efd);
+}
+
+int cq_bind(struct job *job, struct xcq *cq, struct eventfd_ctx *efd)
+{
+	if (cq) {
+		job->cq_rec = kmalloc(sizeof(struct cq_rec), GFP_KERNEL);
+		if (!job->cq_rec)
+			return -ENOMEM;
+		kref_get(&cq->ref);
+		job->cq = cq;
+	}
+	if (efd) {
+		eventfd_ctx_get(efd);
+		job->efd = efd;
+	}
+
+	return 0;
+}
+
+/* the job is destroyed, completed or not */
+void cq_unbind(struct job *job)
+{
+	kfree(job->cq_rec);
+	cq_release(job->cq, job->efd);
+}
@@ -1,132 +1,710 @@
 #include "xjob.h"
+#include <linux/pagemap.h>
+#include <linux/moduleparam.h>
+#include <crypto/hash.h>
 
-/* hash usage borrowed from ecryptfs */
-int checksum(int algo, const char *infile, const char *outfile, int oflags)
+#define CHUNK_PAGES 16 /* infile pages fed to one hash update */
+#define CHUNK_SIZE (CHUNK_PAGES * PAGE_CACHE_SIZE)
+#define NR_CHUNKS 2 /* in flight: one being hashed, the next being read */
+
+/* hash page cache pages in place, instead of copying them to a buffer */
+static bool zero_copy = true;
+module_param(zero_copy, bool, 0644);
+MODULE_PARM_DESC(zero_copy, "hash infile page cache pages without copying");
+
+/* a batch of infile data, page cache pages or a copy in buf */
+struct chunk {
+	struct scatterlist sg[CHUNK_PAGES];
+	struct page *pages[CHUNK_PAGES];
+	int nr_pages;		/* page cache pages to release */
+	unsigned int len;
+	u8 *buf;		/* CHUNK_SIZE, NULL on the page cache path */
+};
+
+/* reads [pos, end) of a file chunk by chunk */
+struct reader {
+	struct file *file;
+	loff_t pos;
+	loff_t end;
+	bool direct;		/* page cache path */
+	int *cancel;		/* of the job, stop between chunks if set */
+};
+
+struct hash_wait {
+	struct completion done;
+	int err;
+};
+
+/* one of the transforms fed from the same chunks */
+struct digest {
+	struct crypto_ahash *tfm;
+	struct ahash_request *req;
+	struct hash_wait wait;
+	int ret;			/* of the update in flight */
+	u8 *out;
+};
+
+/* a XJOB_F_TREE job, its leaves are hashed by whichever consumer is free */
+struct tree {
+	struct list_head list;		/* on trees until every leaf is taken */
+	struct kref ref;		/* the job and every leaf being hashed */
+	struct crypto_ahash *tfm;	/* shared, one request per leaf */
+	struct file *file;
+	int *cancel;			/* of the job */
+	int nr_leaves;
+	int next_leaf;			/* under tree_lock */
+	atomic_t pending;		/* leaves not hashed yet */
+	atomic64_t bytes;
+	int err;			/* of the first failed leaf */
+	u8 *leaves;			/* leaf digests in file order */
+	struct completion done;		/* all leaves hashed */
+};
+
+static LIST_HEAD(trees);
+static DEFINE_SPINLOCK(tree_lock);
+
+static void init_reader(struct reader *r, struct file *file, loff_t pos,
+			loff_t end, int *cancel)
 {
-	struct scatterlist sg;
-	struct crypto_hash *tfm;
-	struct hash_desc desc;
-	struct file *src = NULL;
-	struct file *dst = NULL;
-	u8 *buf = NULL;
-	u8 *hash = NULL;
-	char *digest = NULL;
-	int bytes;
-	int err = 0;
+	struct inode *inode = file->f_mapping->host;
+
+	r->file = file;
+	r->pos = pos;
+	r->end = end;
+	r->cancel = cancel;
+
+	/* fall back to ->read for fs without readpage, or special files
+	 * whose i_size does not tell their length */
+	r->direct = zero_copy && S_ISREG(inode->i_mode) &&
+		file->f_mapping->a_ops->readpage;
+	if (r->direct)
+		r->end = min(end, i_size_read(inode));
+}
+
+static struct chunk *alloc_chunks(struct reader *r)
+{
+	struct chunk *chunks;
 	int i;
-	mm_segment_t old_fs;
 
-	if (algo != ALGORITHM_MD5 && algo != ALGORITHM_SHA1) {
-		err = -EINVAL;
-		INFO("Invalid algorithm for checksum");
-		goto out;
-	}
+	chunks = kzalloc(NR_CHUNKS * sizeof(struct chunk), GFP_KERNEL);
+	if (!chunks || r->direct)
+		return chunks;
 
-	/* open files */
-	src = filp_open(infile, O_RDONLY, 0);
-	if (IS_ERR(src)) {
-		INFO("Error opening infile '%s'", infile);
-		err = PTR_ERR(src);
-		goto out;
-	}
-	dst = filp_open(outfile, oflags | O_CREAT | O_TRUNC | O_WRONLY, 0644);
-	if (IS_ERR(dst)) {
-		INFO("Error opening outfile '%s'", outfile);
-		err = PTR_ERR(dst);
-		goto out;
+	for (i = 0; i < NR_CHUNKS; i++) {
+		chunks[i].buf = kmalloc(CHUNK_SIZE, GFP_KERNEL);
+		if (!chunks[i].buf)
+			goto out_free;
 	}
 
-	/* init hash */
-	tfm = crypto_alloc_hash(get_algo_name(algo), 0, CRYPTO_ALG_ASYNC);
-	if (IS_ERR(tfm)) {
-		err = PTR_ERR(tfm);
-		INFO("Error allocating md5 hash; err = %d", err);
-		goto out;
-	}
-	desc.tfm = tfm;
-	desc.flags = CRYPTO_TFM_REQ_MAY_SLEEP;
+	return chunks;
 
-	err = crypto_hash_init(&desc);
-	if (err) {
-		INFO("Error initializing crypto hash; err = %d", err);
-		goto out_tfm;
-	}
+out_free:
+	while (i--)
+		kfree(chunks[i].buf);
+	kfree(chunks);
+	return NULL;
+}
 
-	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
-	if (!buf) {
-		err = -ENOMEM;
-		goto out_tfm;
+static void free_chunks(struct chunk *chunks)
+{
+	int i;
+
+	for (i = 0; i < NR_CHUNKS; i++)
+		kfree(chunks[i].buf);
+	kfree(chunks);
+}
+
+static void put_chunk(struct chunk *c)
+{
+	int i;
+
+	for (i = 0; i < c->nr_pages; i++)
+		page_cache_release(c->pages[i]);
+	c->nr_pages = 0;
+}
+
+/* reference up to CHUNK_PAGES uptodate page cache pages */
+static int read_chunk_pages(struct reader *r, struct chunk *c)
+{
+	struct address_space *mapping = r->file->f_mapping;
+	struct page *page;
+	pgoff_t index, last;
+	unsigned int offset, len;
+
+	sg_init_table(c->sg, CHUNK_PAGES);
+	last = (r->end - 1) >> PAGE_CACHE_SHIFT;
+
+	while (c->nr_pages < CHUNK_PAGES && r->pos < r->end) {
+		index = r->pos >> PAGE_CACHE_SHIFT;
+		offset = r->pos & ~PAGE_CACHE_MASK;
+		len = min_t(loff_t, PAGE_CACHE_SIZE - offset, r->end - r->pos);
+
+		page = find_get_page(mapping, index);
+		if (!page) {
+			page_cache_sync_readahead(mapping, &r->file->f_ra,
+						  r->file, index,
+						  last - index + 1);
+		} else {
+			if (PageReadahead(page))
+				page_cache_async_readahead(mapping,
+						&r->file->f_ra, r->file, page,
+						index, last - index + 1);
+			page_cache_release(page);
+		}
+
+		/* waits for the read, fails unless the page is uptodate */
+		page = read_mapping_page(mapping, index, r->file);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+
+		c->pages[c->nr_pages] = page;
+		sg_set_page(&c->sg[c->nr_pages], page, len, offset);
+		c->nr_pages++;
+		c->len += len;
+		r->pos += len;
 	}
+	if (c->nr_pages)
+		sg_mark_end(&c->sg[c->nr_pages - 1]);
 
-	sg_init_one(&sg, buf, PAGE_SIZE);
-	src->f_pos = 0;
+	return 0;
+}
+
+/* copy up to CHUNK_SIZE bytes through ->read */
+static int read_chunk_buf(struct reader *r, struct chunk *c)
+{
+	mm_segment_t old_fs;
+	ssize_t bytes = 0;
+	size_t count;
 
-	/* main loop */
 	old_fs = get_fs();
 	set_fs(get_ds());
-	do {
-		bytes = src->f_op->read(src, (__user u8 *)buf,
-				PAGE_SIZE, &src->f_pos);
-		if (bytes < 0) /* empty content can be hashed as well */
+	while (c->len < CHUNK_SIZE && r->pos < r->end) {
+		count = min_t(loff_t, CHUNK_SIZE - c->len, r->end - r->pos);
+		bytes = vfs_read(r->file, (__user char *)c->buf + c->len,
+				 count, &r->pos);
+		if (bytes <= 0)
 			break;
+		c->len += bytes;
+	}
+	set_fs(old_fs);
+
+	if (bytes < 0)
+		return bytes;
+	if (c->len)
+		sg_init_one(c->sg, c->buf, c->len);
+
+	return 0;
+}
+
+/* fill the next chunk of infile, c->len is 0 at end of file */
+static int read_chunk(struct reader *r, struct chunk *c)
+{
+	int err;
+
+	c->nr_pages = 0;
+	c->len = 0;
+
+	if (r->direct)
+		err = read_chunk_pages(r, c);
+	else
+		err = read_chunk_buf(r, c);
+	if (err)
+		put_chunk(c);
+
+	return err;
+}
+
+static void hash_done(struct crypto_async_request *req, int err)
+{
+	struct hash_wait *wait = req->data;
+
+	if (err == -EINPROGRESS) /* left the backlog, still running */
+		return;
+
+	wait->err = err;
+	complete(&wait->done);
+}
+
+/* wait for the hash operation which returned ret */
+static int hash_wait(int ret, struct hash_wait *wait)
+{
+	if (ret == -EINPROGRESS || ret == -EBUSY) {
+		wait_for_completion(&wait->done);
+		INIT_COMPLETION(wait->done);
+		ret = wait->err;
+	}
+
+	return ret;
+}
+
+/* wait for the updates of every digest, issued on the same chunk */
+static int wait_updates(struct digest *d, int nr)
+{
+	int err = 0;
+	int ret;
+	int k;
+
+	for (k = 0; k < nr; k++) {
+		ret = hash_wait(d[k].ret, &d[k].wait);
+		if (!err)
+			err = ret;
+	}
+
+	return err;
+}
+
+/* hash the rest of the reader into every digest, reading it once.
+ * with async hash drivers, reading chunk n+1 overlaps hashing chunk n;
+ * synchronous drivers complete the update before it returns */
+static int hash_file(struct digest *d, int nr, struct reader *r, u64 *bytes)
+{
+	struct chunk *chunks;
+	struct chunk *c;
+	struct chunk *busy = NULL; /* being hashed */
+	int nr_reqs = 0;
+	int err = 0;
+	int ret;
+	int i = 0;
+	int k;
+
+	chunks = alloc_chunks(r);
+	if (!chunks)
+		return -ENOMEM;
+
+	for (k = 0; k < nr; k++, nr_reqs++) {
+		d[k].req = ahash_request_alloc(d[k].tfm, GFP_KERNEL);
+		if (!d[k].req) {
+			err = -ENOMEM;
+			goto out;
+		}
+		init_completion(&d[k].wait.done);
+		ahash_request_set_callback(d[k].req, CRYPTO_TFM_REQ_MAY_SLEEP |
+					   CRYPTO_TFM_REQ_MAY_BACKLOG,
+					   hash_done, &d[k].wait);
+	}
+
+	for (k = 0; k < nr && !err; k++)
+		err = hash_wait(crypto_ahash_init(d[k].req), &d[k].wait);
+	while (!err) {
+		c = &chunks[i];
+		i = (i + 1) % NR_CHUNKS;
 
-		err = crypto_hash_update(&desc, &sg, bytes);
-		if (err) {
-			INFO("Error updating crypto hash; err = %d", err);
+		if (ACCESS_ONCE(*r->cancel))
+			err = -ECANCELED;
+		else
+			err = read_chunk(r, c);
+		if (busy) {
+			ret = wait_updates(d, nr);
+			put_chunk(busy);
+			busy = NULL;
+			if (!err)
+				err = ret;
+		}
+		if (err || !c->len) {
+			put_chunk(c);
 			break;
 		}
-	} while (bytes > 0);
-	set_fs(old_fs);
 
-	if (bytes < 0) {
-		err = bytes;
-		goto out_tfm;
+		*bytes += c->len;
+		for (k = 0; k < nr; k++) {
+			ahash_request_set_crypt(d[k].req, c->sg, NULL, c->len);
+			d[k].ret = crypto_ahash_update(d[k].req);
+		}
+		busy = c;
 	}
 	if (err)
-		goto out_tfm;
+		INFO("Error hashing infile; err = %d", err);
 
-	/* finalize */
-	hash = kmalloc(get_hash_size(algo), GFP_KERNEL);
-	if (!hash) {
-		err = -ENOMEM;
-		goto out_tfm;
+	/* empty content can be hashed as well */
+	for (k = 0; k < nr && !err; k++) {
+		ahash_request_set_crypt(d[k].req, NULL, d[k].out, 0);
+		err = hash_wait(crypto_ahash_final(d[k].req), &d[k].wait);
+		if (err)
+			INFO("Error finalizing crypto hash; err = %d", err);
 	}
-	digest = kmalloc(get_digest_size(algo) + 1, GFP_KERNEL);
-	if (!digest) {
-		err = -ENOMEM;
-		goto out_tfm;
+
+out:
+	for (k = 0; k < nr_reqs; k++)
+		ahash_request_free(d[k].req);
+	free_chunks(chunks);
+
+	return err;
+}
+
+/* digest of a kmalloc'ed buffer */
+static int hash_buf(struct crypto_ahash *tfm, u8 *buf, unsigned int len,
+		    u8 *out)
+{
+	struct ahash_request *req;
+	struct hash_wait wait;
+	struct scatterlist sg;
+	int err;
+
+	req = ahash_request_alloc(tfm, GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	init_completion(&wait.done);
+	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_SLEEP |
+				   CRYPTO_TFM_REQ_MAY_BACKLOG,
+				   hash_done, &wait);
+
+	/* no update for an empty buffer, digest would touch the sg */
+	err = hash_wait(crypto_ahash_init(req), &wait);
+	if (!err && len) {
+		sg_init_one(&sg, buf, len);
+		ahash_request_set_crypt(req, &sg, NULL, len);
+		err = hash_wait(crypto_ahash_update(req), &wait);
+	}
+	if (!err) {
+		ahash_request_set_crypt(req, NULL, out, 0);
+		err = hash_wait(crypto_ahash_final(req), &wait);
+	}
+
+	ahash_request_free(req);
+
+	return err;
+}
+
+static void tree_free(struct kref *ref)
+{
+	struct tree *t = container_of(ref, struct tree, ref);
+
+	kfree(t->leaves);
+	kfree(t);
+}
+
+/* take the next leaf of t, or of any tree if t is NULL */
+static struct tree *take_leaf(struct tree *t, int *leaf)
+{
+	spin_lock(&tree_lock);
+	if (!t && !list_empty(&trees))
+		t = list_first_entry(&trees, struct tree, list);
+	else if (t && list_empty(&t->list))
+		t = NULL;
+
+	if (t) {
+		*leaf = t->next_leaf++;
+		if (t->next_leaf == t->nr_leaves)
+			list_del_init(&t->list);
+		kref_get(&t->ref);
+	}
+	spin_unlock(&tree_lock);
+
+	return t;
+}
+
+static void hash_leaf(struct tree *t, int leaf)
+{
+	unsigned int size = crypto_ahash_digestsize(t->tfm);
+	struct digest d;
+	struct reader r;
+	loff_t pos;
+	u64 bytes = 0;
+	int err;
+
+	/* the root is lost after an error, skip the rest */
+	if (!ACCESS_ONCE(t->err)) {
+		pos = (loff_t)leaf << TREE_LEAF_SHIFT;
+		init_reader(&r, t->file, pos, pos + TREE_LEAF_SIZE,
+			    t->cancel);
+		d.tfm = t->tfm;
+		d.out = t->leaves + leaf * size;
+		err = hash_file(&d, 1, &r, &bytes);
+		if (err)
+			cmpxchg(&t->err, 0, err);
+		atomic64_add(bytes, &t->bytes);
+	}
+
+	if (atomic_dec_and_test(&t->pending))
+		complete(&t->done);
+	kref_put(&t->ref, tree_free);
+}
+
+bool tree_pending(void)
+{
+	return !list_empty(&trees);
+}
+
+/* hash one leaf for a running tree job, false if no leaf is left */
+bool hash_tree_leaf(void)
+{
+	struct tree *t;
+	int leaf;
+
+	t = take_leaf(NULL, &leaf);
+	if (!t)
+		return false;
+	hash_leaf(t, leaf);
+
+	return true;
+}
+
+/* tree digest of src, see TREE_LEAF_SHIFT. idle consumers hash leaves
+ * while this one does the same, so it never waits for a free consumer */
+static int hash_tree(struct crypto_ahash *tfm, struct file *src, u8 *out,
+		     u64 *bytes, int *cancel)
+{
+	unsigned int size = crypto_ahash_digestsize(tfm);
+	struct tree *t;
+	loff_t nr;
+	int leaf;
+	int err = 0;
+
+	/* no 64 bit division on 32 bit */
+	nr = (i_size_read(src->f_mapping->host) + TREE_LEAF_SIZE - 1) >>
+		TREE_LEAF_SHIFT;
+	if (nr * size > KMALLOC_MAX_SIZE)
+		return -EFBIG;
+
+	t = kzalloc(sizeof(struct tree), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+	kref_init(&t->ref);
+	INIT_LIST_HEAD(&t->list);
+	t->tfm = tfm;
+	t->file = src;
+	t->cancel = cancel;
+	t->nr_leaves = nr;
+	atomic_set(&t->pending, nr);
+	atomic64_set(&t->bytes, 0);
+	init_completion(&t->done);
+
+	if (nr) {
+		t->leaves = kmalloc(nr * size, GFP_KERNEL);
+		if (!t->leaves) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		spin_lock(&tree_lock);
+		list_add_tail(&t->list, &trees);
+		spin_unlock(&tree_lock);
+		wake_up_nr(&cwq, nr - 1);
+
+		while (take_leaf(t, &leaf))
+			hash_leaf(t, leaf);
+		wait_for_completion(&t->done);
+		err = t->err;
 	}
 
-	err = crypto_hash_final(&desc, hash);
-	if (err) {
-		INFO("Error finalizing crypto hash; err = %d", err);
-		goto out_tfm;
+	if (!err)
+		err = hash_buf(tfm, t->leaves, nr * size, out);
+	*bytes = atomic64_read(&t->bytes);
+
+out:
+	kref_put(&t->ref, tree_free);
+	return err;
+}
+
+/* algorithms of job in output order, one unless XJOB_F_ALGO_MASK.
+ * return how many, 0 if any of them is not a hash */
+static int job_algos(struct job *job, int *algos)
+{
+	int algo;
+	int nr = 0;
+
+	if (!(job->flags & XJOB_F_ALGO_MASK)) {
+		algos[0] = job->algo;
+		return get_hash_size(job->algo) ? 1 : 0;
+	}
+	if (job->algo & ~ALGO_HASH_MASK)
+		return 0;
+
+	for (algo = ALGORITHM_MD5; algo <= ALGORITHM_SHA256; algo++) {
+		if (job->algo & ALGO_BIT(algo))
+			algos[nr++] = algo;
+	}
+
+	return nr;
+}
+
+/* hash the infile of job into job->hash, one digest after the other */
+static int hash_infile(struct job *job, struct file *src, int *algos,
+		       int nr)
+{
+	struct digest d[ALGORITHM_LAST];
+	struct reader reader;
+	ktime_t start = ktime_get();
+	u8 *out = job->hash;
+	int err = 0;
+	int k;
+
+	/* async and offload drivers are welcome */
+	for (k = 0; k < nr; k++) {
+		d[k].tfm = crypto_alloc_ahash(get_algo_name(algos[k]), 0, 0);
+		if (IS_ERR(d[k].tfm)) {
+			err = PTR_ERR(d[k].tfm);
+			INFO("Error allocating %s hash; err = %d",
+			     get_algo_name(algos[k]), err);
+			goto out;
+		}
+		d[k].out = out;
+		out += get_hash_size(algos[k]);
 	}
 
-	for (i = 0; i < get_hash_size(algo); i++)
-		sprintf(digest + 2 * i, "%02x", hash[i]);
-	INFO("%.*s", get_digest_size(algo), digest);
+	init_reader(&reader, src, 0, LLONG_MAX, &job->cancel);
+	if (job->flags & XJOB_F_TREE)
+		err = hash_tree(d[0].tfm, src, d[0].out, &job->bytes,
+				&job->cancel);
+	else
+		err = hash_file(d, nr, &reader, &job->bytes);
+	/* per job, only with dynamic debug */
+	if (!err)
+		pr_debug("%s: %llu bytes in %lld us, %d digests, %s%s, %s\n",
+			 job->infile, job->bytes,
+			 ktime_to_us(ktime_sub(ktime_get(), start)), nr,
+			 job->flags & XJOB_F_TREE ? "tree, " : "",
+			 reader.direct ? "zero copy" : "buffered",
+			 crypto_tfm_alg_driver_name(
+				 crypto_ahash_tfm(d[0].tfm)));
+
+out:
+	while (k--)
+		crypto_free_ahash(d[k].tfm);
+
+	return err;
+}
+
+/* write the hex digests of job->hash to dst: the digest alone for one
+ * algorithm, or an "algo digest" line per algorithm */
+static int write_digest(struct job *job, struct file *dst, int *algos,
+			int nr)
+{
+	char digest[2 * HASH_ALL_SIZE + 3 * 8]; /* and names, newlines */
+	mm_segment_t old_fs;
+	u8 *hash = job->hash;
+	int size = 0;
+	int bytes;
+	int i, k;
+
+	for (k = 0; k < nr; k++) {
+		if (nr > 1)
+			size += sprintf(digest + size, "%s ",
+					get_algo_name(algos[k]));
+		for (i = 0; i < get_hash_size(algos[k]); i++)
+			size += sprintf(digest + size, "%02x", *hash++);
+		if (nr > 1)
+			digest[size++] = '\n';
+	}
+	pr_debug("%.*s\n", size, digest);
 
 	old_fs = get_fs();
 	set_fs(get_ds());
-	bytes = dst->f_op->write(dst, (__user char *)digest,
-			get_digest_size(algo), &dst->f_pos);
+	bytes = dst->f_op->write(dst, (__user char *)digest, size,
+				 &dst->f_pos);
 	set_fs(old_fs);
 	if (bytes < 0)
-		err = bytes;
-	else if (bytes != get_digest_size(algo))
-		err = -EIO;
+		return bytes;
+	if (bytes != size)
+		return -EIO;
+
+	return 0;
+}
+
+/* NULL for XJOB_F_NO_OUTFILE */
+static struct file *open_outfile(struct job *job)
+{
+	struct file *dst;
+
+	if (job->flags & XJOB_F_NO_OUTFILE)
+		return NULL;
+
+	dst = filp_open(job->outfile,
+			job->oflags | O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (IS_ERR(dst))
+		INFO("Error opening outfile '%s'", job->outfile);
+
+	return dst;
+}
+
+int checksum(struct job *job)
+{
+	int algos[ALGORITHM_LAST];
+	struct file_stamp stamp;
+	struct file *src = NULL;
+	struct file *dst = NULL;
+	unsigned int flags;
+	bool cacheable, cached;
+	u8 *hash;
+	int err = 0;
+	int nr, k;
+
+	/* a tree digest is computed for one algorithm only */
+	nr = job_algos(job, algos);
+	if (!nr || (nr > 1 && (job->flags & XJOB_F_TREE))) {
+		err = -EINVAL;
+		INFO("Invalid algorithm for checksum");
+		goto out;
+	}
+
+	/* open files */
+	src = filp_open(job->infile, O_RDONLY, 0);
+	if (IS_ERR(src)) {
+		INFO("Error opening infile '%s'", job->infile);
+		err = PTR_ERR(src);
+		goto out;
+	}
+	dst = open_outfile(job);
+	if (IS_ERR(dst)) {
+		err = PTR_ERR(dst);
+		goto out;
+	}
+
+	/* an unchanged infile is not read again, unless one of its
+	 * digests is missing */
+	cacheable = get_file_stamp(src->f_mapping->host, &stamp);
+	cached = cacheable;
+	flags = job->flags & XJOB_F_TREE; /* digests differ in tree mode */
+	for (k = 0, hash = job->hash; k < nr && cached; k++) {
+		cached = cache_lookup(&stamp, algos[k], flags, hash);
+		hash += get_hash_size(algos[k]);
+	}
+	if (cached) {
+		pr_debug("%s: cached\n", job->infile);
+	} else {
+		err = hash_infile(job, src, algos, nr);
+		if (err)
+			goto out;
+		for (k = 0, hash = job->hash; k < nr; k++) {
+			if (cacheable)
+				cache_insert(&stamp, algos[k], flags, hash);
+			hash += get_hash_size(algos[k]);
+		}
+	}
+	job->hash_len = hash - job->hash;
+
+	if (dst)
+		err = write_digest(job, dst, algos, nr);
 
-out_tfm:
-	crypto_free_hash(tfm);
 out:
 	if (src && !IS_ERR(src))
 		filp_close(src, NULL);
 	if (dst && !IS_ERR(dst))
 		filp_close(dst, NULL);
-	kfree(buf);
-	kfree(hash);
-	kfree(digest);
+
+	return err;
+}
+
+/* job was coalesced with leader, which has hashed the same infile */
+int checksum_follow(struct job *job, struct job *leader)
+{
+	int algos[ALGORITHM_LAST];
+	struct file *dst;
+	int err;
+	int nr;
+
+	memcpy(job->hash, leader->hash, sizeof(job->hash));
+	job->hash_len = leader->hash_len;
+	nr = job_algos(job, algos);
+
+	dst = open_outfile(job);
+	if (!dst)
+		return 0;
+	if (IS_ERR(dst))
+		return PTR_ERR(dst);
+	err = write_digest(job, dst, algos, nr);
+	filp_close(dst, NULL);
 
 	return err;
 }
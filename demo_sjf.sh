@@ -0,0 +1,17 @@
+#!/bin/bash
+# mean completion time of a mixed-size workload, FIFO then SJF.
+# two large jobs are queued ahead of three small ones
+set -x
+for n in 300 200 1 2 3; do
+	[ -f ${n}m ] || python genfile.py $n
+done
+p=/sys/module/sys_xjob/parameters
+echo 0 > $p/cache_size
+for policy in 0 1; do
+	echo $policy > $p/sched_policy
+	sync; echo 3 > /proc/sys/vm/drop_caches
+	printf "300m\n200m\n1m\n2m\n3m\n" | ./xhw3 -B -F -C -a sha1 -w |
+		tee sjf.$policy.log
+	grep -o '[0-9.]* ms' sjf.$policy.log |
+		awk '{ s += $1 } END { print "mean:", s / NR, "ms" }'
+done
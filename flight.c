@@ -0,0 +1,127 @@
+#include "xjob.h"
+#ifndef XJOB_SHIM
+#include <linux/hash.h>
+#include <linux/dcache.h>
+#endif
+
+#define FLIGHT_HASH_BITS 6
+
+/* single flight: a checksum job identical to one already queued or being
+ * processed (the leader) is not queued, it waits on the leader's
+ * followers list and only gets the leader's digest written out */
+static struct hlist_head flight_table[1 << FLIGHT_HASH_BITS];
+static DEFINE_SPINLOCK(flight_lock);	/* protect the table and followers */
+
+static bool flight_match(struct job *a, struct job *b)
+{
+	unsigned int mask = XJOB_F_JOB & ~XJOB_F_NO_OUTFILE;
+
+	return a->category == b->category && a->algo == b->algo &&
+		(a->flags & mask) == (b->flags & mask) &&
+		strcmp(a->infile, b->infile) == 0;
+}
+
+static struct hlist_head *flight_bucket(struct job *job)
+{
+	unsigned int h = full_name_hash(job->infile, strlen(job->infile));
+
+	return &flight_table[hash_32(h, FLIGHT_HASH_BITS)];
+}
+
+/* grab flight_lock first */
+static struct job *find_leader(struct job *job)
+{
+	struct job *leader;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(leader, node, flight_bucket(job), flight) {
+		if (flight_match(leader, job))
+			return leader;
+	}
+
+	return NULL;
+}
+
+/* attach job to an identical pending job, which then owns it */
+bool flight_join(struct job *job)
+{
+	struct job *leader;
+
+	if (job->category != CATEGORY_CHECKSUM)
+		return false;
+
+	spin_lock(&flight_lock);
+	leader = find_leader(job);
+	if (leader) {
+		list_add_tail(&job->list, &leader->followers);
+		job->following = true;
+		job->state = STATE_PENDING;
+		pr_debug("job[%d] follows job[%d]\n", job->id, leader->id);
+	}
+	spin_unlock(&flight_lock);
+
+	return leader != NULL;
+}
+
+/* job is about to be queued, let identical jobs join it */
+void flight_lead(struct job *job)
+{
+	if (job->category != CATEGORY_CHECKSUM)
+		return;
+
+	spin_lock(&flight_lock);
+	if (!find_leader(job))
+		hlist_add_head(&job->flight, flight_bucket(job));
+	spin_unlock(&flight_lock);
+}
+
+/* job is done or discarded, its followers are moved to the list */
+void flight_end(struct job *job, struct list_head *followers)
+{
+	struct job *follower;
+
+	spin_lock(&flight_lock);
+	if (!hlist_unhashed(&job->flight))
+		hlist_del_init(&job->flight);
+	list_for_each_entry(follower, &job->followers, list)
+		follower->following = false;
+	list_splice_init(&job->followers, followers);
+	spin_unlock(&flight_lock);
+}
+
+/* job is removed from its queue, its first follower leads the others
+ * and should be queued in its place */
+struct job *flight_promote(struct job *job)
+{
+	struct job *next = NULL;
+
+	spin_lock(&flight_lock);
+	if (!hlist_unhashed(&job->flight))
+		hlist_del_init(&job->flight);
+	if (!list_empty(&job->followers)) {
+		next = list_first_entry(&job->followers, struct job, list);
+		list_del(&next->list);
+		next->following = false;
+		list_splice_init(&job->followers, &next->followers);
+		hlist_add_head(&next->flight, flight_bucket(next));
+	}
+	spin_unlock(&flight_lock);
+
+	return next;
+}
+
+/* detach job from its leader, false if it does not follow one */
+bool flight_detach(struct job *job)
+{
+	bool following;
+
+	spin_lock(&flight_lock);
+	following = job->following;
+	if (following) {
+		list_del(&job->list);
+		job->following = false;
+	}
+	spin_unlock(&flight_lock);
+
+	return following;
+}
@@ -0,0 +1,180 @@
+#include "xjob.h"
+#include <linux/radix-tree.h>
+
+#define COMPLETED_SIZE 1024 /* finished jobs remembered for ACTION_STATUS */
+#define LIST_BATCH 32 /* jobs looked up per rcu read section */
+
+/* every submitted job by id, from produce_batch() until destroy_job().
+ * index_lock only serializes the updates: lookups run under rcu, as a
+ * job is freed an rcu grace period after it is unindexed. nodes come
+ * from the per cpu preload, or atomically once it runs out */
+static DEFINE_SPINLOCK(index_lock);
+static RADIX_TREE(job_index, GFP_ATOMIC);
+
+/* the most recent finished jobs, slot id % COMPLETED_SIZE. ids are
+ * handed out in order, so a slot is only reused by a later job */
+static struct jobstatus completed[COMPLETED_SIZE];
+
+static void fill_status(struct job *job, struct jobstatus *st)
+{
+	st->id = job->id;
+	st->state = job->state;
+	st->err = job->err;
+	st->bytes = job->bytes;
+	st->size = job->size;
+	st->hash_len = job->state == STATE_SUCCESS ? job->hash_len : 0;
+	memcpy(st->hash, job->hash, st->hash_len);
+}
+
+/* the ids of a batch are consecutive, so that its jobs mostly share the
+ * nodes preloaded for one insert. a job whose id is taken already, or
+ * that gets no node, is only left out of the index */
+void index_jobs(struct job **jobs, int nr)
+{
+	bool preloaded = !radix_tree_preload(GFP_KERNEL);
+	int i;
+
+	spin_lock(&index_lock);
+	for (i = 0; i < nr; i++) {
+		if (radix_tree_insert(&job_index, jobs[i]->id, jobs[i]))
+			INFO("job[%d]: not indexed", jobs[i]->id);
+	}
+	spin_unlock(&index_lock);
+	if (preloaded)
+		radix_tree_preload_end();
+}
+
+/* job is about to be freed, remember how it ended. return whether it
+ * was indexed */
+bool unindex_job(struct job *job)
+{
+	bool indexed;
+
+	spin_lock(&index_lock);
+	indexed = radix_tree_lookup(&job_index, job->id) == job;
+	if (indexed)
+		radix_tree_delete(&job_index, job->id);
+	if (job->state >= STATE_SUCCESS)
+		fill_status(job, &completed[job->id % COMPLETED_SIZE]);
+	spin_unlock(&index_lock);
+
+	return indexed;
+}
+
+/* grab rcu_read_lock() first, the job is only valid until it is
+ * dropped unless the caller pins it otherwise */
+struct job *lookup_job(int id)
+{
+	return radix_tree_lookup(&job_index, id);
+}
+
+int job_status(int id, __user struct jobstatus *buf)
+{
+	struct jobstatus st;
+	struct job *job;
+	int err = 0;
+
+	if (id <= 0)
+		return -EINVAL;
+
+	rcu_read_lock();
+	job = lookup_job(id);
+	if (job)
+		fill_status(job, &st);
+	rcu_read_unlock();
+
+	/* unindexed, it is in completed by the time the lock is free */
+	if (!job) {
+		spin_lock(&index_lock);
+		if (completed[id % COMPLETED_SIZE].id == id)
+			st = completed[id % COMPLETED_SIZE];
+		else
+			err = -ENOENT;
+		spin_unlock(&index_lock);
+	}
+
+	if (!err && copy_to_user(buf, &st, sizeof(struct jobstatus)))
+		err = -EFAULT;
+
+	return err;
+}
+
+static bool list_match(struct job *job, struct jobfilter *filter)
+{
+	unsigned int states = filter->states ? filter->states :
+		STATE_BIT(STATE_PENDING);
+
+	return (states & STATE_BIT(ACCESS_ONCE(job->state))) &&
+		(!filter->pid || job->pid == filter->pid) &&
+		(!filter->category || job->category == filter->category);
+}
+
+static void fill_jobent(struct job *job, struct jobent *ent)
+{
+	int name_len = strlen(job->infile);
+
+	if (name_len > NAME_MAX)
+		name_len = NAME_MAX;
+
+	ent->id = job->id;
+	ent->pid = job->pid;
+	ent->category = job->category;
+	ent->priority = job->priority;
+	ent->state = ACCESS_ONCE(job->state);
+	ent->name_len = name_len;
+	memcpy(ent->infile, job->infile, name_len);
+	ent->infile[name_len] = '\0';
+}
+
+/* list the jobs matching filter with id >= cursor, by id. no lock is
+ * taken: jobs are read under rcu a batch at a time, and copied out once
+ * it is dropped. return how many were listed, fewer than len at the end */
+int list_jobs(__user struct jobent *buf, int len, unsigned int cursor,
+	      struct jobfilter *filter)
+{
+	struct job *jobs[LIST_BATCH];
+	struct jobent *ents;
+	unsigned long index = cursor;
+	int count = 0;
+	int err = 0;
+	int nr, n, i;
+
+	if (len <= 0 || len > INT_MAX / sizeof(struct jobent))
+		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, buf, len * sizeof(struct jobent)))
+		return -EFAULT;
+
+	ents = kmalloc(LIST_BATCH * sizeof(struct jobent), GFP_KERNEL);
+	if (!ents)
+		return -ENOMEM;
+
+	do {
+		n = 0;
+		rcu_read_lock();
+		nr = radix_tree_gang_lookup(&job_index, (void **)jobs, index,
+					    LIST_BATCH);
+		for (i = 0; i < nr && count + n < len; i++) {
+			index = jobs[i]->id + 1;
+			if (list_match(jobs[i], filter))
+				fill_jobent(jobs[i], &ents[n++]);
+		}
+		rcu_read_unlock();
+
+		if (__copy_to_user(buf + count, ents,
+				   n * sizeof(struct jobent))) {
+			err = -EFAULT;
+			goto out;
+		}
+		count += n;
+		cond_resched();
+	} while (nr == LIST_BATCH && count < len);
+
+	/* set id = 0 to suggest end of list */
+	if (count < len)
+		__put_user(0, &buf[count].id);
+	err = count;
+out:
+	kfree(ents);
+
+	return err;
+}
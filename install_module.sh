@@ -2,5 +2,6 @@
 set -x
 lsmod
 rmmod sys_xjob
+modprobe zlib_deflate
 insmod sys_xjob.ko
 lsmod
@@ -1,54 +1,176 @@
 #include "xjob.h"
 #include <linux/moduleloader.h>
+#include <linux/moduleparam.h>
+#include <linux/proc_fs.h>
 
-struct queue *head, *tail;
-struct mutex qmutex; /* protect job queue & wait queue */
-int qlen;
-int qmax;
+#define CREATE_TRACE_POINTS
+#include "xjob_trace.h"
+
+struct jqueue *jqueues;
+int nr_jqueues;
+atomic_t qlen;
+int qmax = Q_MAX_SIZE;
 wait_queue_head_t pwq;
 wait_queue_head_t cwq;
 struct task_struct **cthreads;
 bool should_stop;
 unsigned curr_id;
 int num_consumer;
+struct proc_dir_entry *proc_xjob;
+
+static DEFINE_MUTEX(consumer_lock); /* protect cthreads and num_consumer */
+static bool started;		/* queues are up, consumers may be resized */
+static int init_consumers;	/* num_consumer given at load, 0 for auto */
 
 static spinlock_t job_id_lock;
+static struct kmem_cache *job_cachep;
+static struct kmem_cache *path_cachep;
+
+static void free_job_paths(struct job *job)
+{
+	if (!job->paths)
+		return;
+
+	if (job->paths_len <= PATH_CACHE_SIZE)
+		kmem_cache_free(path_cachep, job->paths);
+	else
+		kfree(job->paths);
+}
+
+struct job *alloc_job(void)
+{
+	return kmem_cache_alloc(job_cachep, GFP_KERNEL);
+}
+
+static void free_job(struct rcu_head *rcu)
+{
+	struct job *job = container_of(rcu, struct job, rcu);
+
+	free_job_paths(job);
+	kmem_cache_free(job_cachep, job);
+}
 
 void destroy_job(struct job *job)
 {
-	if (job->infile && !IS_ERR(job->infile))
-		putname(job->infile);
+	bool indexed = unindex_job(job);
+
+	if (job->ring)
+		ring_put(job->ring);
+	cq_unbind(job);
+	/* list_jobs() may still be reading it */
+	if (indexed)
+		call_rcu(&job->rcu, free_job);
+	else
+		free_job(&job->rcu);
+}
+
+/* destroy a job that will never be processed */
+void discard_job(struct job *job)
+{
+	struct job *f, *tmp;
+	LIST_HEAD(followers);
 
-	if (job->outfile && !IS_ERR(job->outfile))
-		putname(job->outfile);
+	flight_end(job, &followers);
+	list_for_each_entry_safe(f, tmp, &followers, list) {
+		list_del(&f->list);
+		discard_job(f);
+	}
 
-	kfree(job);
+	job->state = STATE_ABORTE;
+	job->err = -ECANCELED;
+	notify_user(job, -ECANCELED, -1);
+	destroy_job(job);
 }
 
-/* create a global unique job id
+/* create nr consecutive global unique job ids, return the first one
  * XXX may use random generateor to make it safer */
-static int new_job_id(void)
+int new_job_ids(int nr)
 {
 	int ret;
 
 	spin_lock(&job_id_lock);
-	ret = ++curr_id;
-	if (curr_id == INT_MAX)
+	if (curr_id > INT_MAX - nr)
 		curr_id = 0;
+	ret = curr_id + 1;
+	curr_id += nr;
 	spin_unlock(&job_id_lock);
 
 	return ret;
 }
 
-static int init_job(struct job *job, struct xargs *xarg)
+static int new_job_id(void)
+{
+	return new_job_ids(1);
+}
+
+/* copy infile and outfile into one buffer sized to their real length */
+static int copy_job_paths(struct job *job, __user const char *infile,
+			  __user const char *outfile)
+{
+	bool no_outfile = !outfile && (job->flags & XJOB_F_NO_OUTFILE);
+	long inlen, outlen;
+
+	inlen = strnlen_user(infile, PATH_MAX);
+	outlen = no_outfile ? 1 : strnlen_user(outfile, PATH_MAX);
+	if (!inlen || !outlen) {
+		INFO("invalid path address");
+		return -EFAULT;
+	}
+	if (inlen > PATH_MAX || outlen > PATH_MAX)
+		return -ENAMETOOLONG;
+
+	job->paths_len = inlen + outlen;
+	if (job->paths_len <= PATH_CACHE_SIZE)
+		job->paths = kmem_cache_alloc(path_cachep, GFP_KERNEL);
+	else
+		job->paths = kmalloc(job->paths_len, GFP_KERNEL);
+	if (!job->paths)
+		return -ENOMEM;
+
+	if (copy_from_user(job->paths, infile, inlen) ||
+	    (!no_outfile && copy_from_user(job->paths + inlen, outfile,
+					   outlen)))
+		return -EFAULT;
+	/* user may change the strings after strnlen_user */
+	job->paths[inlen - 1] = '\0';
+	job->paths[job->paths_len - 1] = '\0';
+
+	job->infile = job->paths;
+	job->outfile = job->paths + inlen;
+
+	return 0;
+}
+
+int init_job(struct job *job, struct jobdesc *desc)
 {
+	int err;
+
 	job->state = STATE_NEW;
-	job->id = xarg->id;
-	job->oflags = xarg->oflags;
-	job->category = xarg->category;
-	job->algo = xarg->algo;
+	job->err = 0;
+	job->id = desc->id;
+	job->oflags = desc->oflags;
+	job->flags = desc->flags;
+	job->level = desc->level;
+	job->priority = desc->priority ? desc->priority : PRIORITY_NORMAL;
+	job->category = desc->category;
+	job->algo = desc->algo;
 	job->infile = NULL;
 	job->outfile = NULL;
+	job->paths = NULL;
+	job->ring = NULL;
+	job->user_data = 0;
+	job->cq = NULL;
+	job->efd = NULL;
+	job->cq_rec = NULL;
+	job->submit_time = ktime_get();
+	job->bytes = 0;
+	job->hash_len = 0;
+	job->cancel = 0;
+	job->size = 0;
+	job->jq = NULL;
+	job->following = false;
+	INIT_HLIST_NODE(&job->flight);
+	INIT_LIST_HEAD(&job->followers);
 	job->pid = current->pid;
 
 	if (job->id <= 0) {
@@ -62,132 +184,274 @@ static int init_job(struct job *job, struct xargs *xarg)
 		return -EINVAL;
 	}
 
+	if (job->priority >= PRIORITY_LAST) {
+		INFO("Invalid job priority");
+		return -EINVAL;
+	}
+
 	/* XXX should check algorithm here? maybe do not need algo? */
-	if (job->algo == ALGORITHM_UNDEFINED
+	if (job->flags & XJOB_F_ALGO_MASK) {
+		if (!job->algo || job->algo & ~ALGO_HASH_MASK) {
+			INFO("Invalid algorithm mask");
+			return -EINVAL;
+		}
+	} else if (job->algo == ALGORITHM_UNDEFINED
 			|| job->algo >= ALGORITHM_LAST) {
 		INFO("Invalid algorithm");
 		return -EINVAL;
 	}
 
-	job->infile = getname(xarg->infile);
-	if (IS_ERR(job->infile)) {
-		INFO("infile getname failed");
-		return -EFAULT;
+	/* a decompression learns its algorithm from the infile, else it
+	 * is checked before the outfile is truncated */
+	if (job->category == CATEGORY_COMPRESS &&
+	    !(job->flags & XJOB_F_DECOMPRESS)) {
+		err = codec_supported(job->algo, false);
+		if (err) {
+			INFO("Unsupported compression algorithm");
+			return err;
+		}
 	}
 
-	job->outfile = getname(xarg->outfile);
-	if (IS_ERR(job->outfile)) {
-		INFO("outfile getname failed");
-		return -EFAULT;
+	if ((job->flags & XJOB_F_NO_OUTFILE) &&
+	    job->category != CATEGORY_CHECKSUM) {
+		INFO("Only a checksum can go without outfile");
+		return -EINVAL;
 	}
 
-	return 0;
+	return copy_job_paths(job, desc->infile, desc->outfile);
 }
 
-static int remove_queued_jobs(void)
+/* size the infile for the scheduler, it is not opened until processed */
+void stat_infile(struct job *job)
 {
-	struct queue *q;
+	struct path path;
 
-	mutex_lock(&qmutex);
-	INFO("removing all...");
+	if (kern_path(job->infile, LOOKUP_FOLLOW, &path))
+		return;
+	job->size = i_size_read(path.dentry->d_inode);
+	path_put(&path);
+}
+
+/* On success the number of queued jobs is returned, the id and err of
+ * every entry are written back to batch_buf */
+static int submit_batch(struct xargs *xarg)
+{
+	__user struct jobdesc *batch_buf = xarg->batch_buf;
+	unsigned int batch_len = xarg->batch_len;
+	struct jobdesc *descs = NULL;
+	struct jobdesc *desc;
+	struct job **jobs = NULL;
+	struct job *job;
+	struct xcq *cq = NULL;
+	struct eventfd_ctx *efd = NULL;
+	int first_id;
+	int nr_jobs = 0;
+	int queued = 0;
+	int err = 0;
+	int i;
 
-	while (head) {
-		q = remove_first_job();
-		qlen--;
-		destroy_job(q->job);
-		kfree(q);
+	if (batch_len == 0 || batch_len > JOB_BATCH_MAX)
+		return -EINVAL;
+	if (xarg->flags & XJOB_F_CQ) {
+		err = cq_get(xarg->cq_fd, &cq, &efd);
+		if (err)
+			return err;
+	}
+
+	descs = kmalloc(batch_len * sizeof(struct jobdesc), GFP_KERNEL);
+	jobs = kmalloc(batch_len * sizeof(struct job *), GFP_KERNEL);
+	if (!descs || !jobs) {
+		err = -ENOMEM;
+		goto out;
+	}
+	if (copy_from_user(descs, batch_buf,
+			   batch_len * sizeof(struct jobdesc))) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	first_id = new_job_ids(batch_len);
+	for (i = 0; i < batch_len; i++) {
+		desc = &descs[i];
+		desc->id = first_id + i;
+		job = alloc_job();
+		if (!job) {
+			desc->err = -ENOMEM;
+			continue;
+		}
+		desc->err = init_job(job, desc);
+		if (desc->err) {
+			destroy_job(job);
+			continue;
+		}
+		if (xarg->flags & XJOB_F_CQ)
+			desc->err = cq_bind(job, cq, efd);
+		if (desc->err) {
+			destroy_job(job);
+			continue;
+		}
+		jobs[nr_jobs++] = job;
 	}
-	wake_up_all(&pwq);
 
-	mutex_unlock(&qmutex);
+	err = produce_batch(jobs, nr_jobs, xarg->flags, xarg->timeout_ms,
+			    &queued);
 
-	return 0;
+	/* queued jobs may be gone already, only touch the rest */
+	for (i = queued; i < nr_jobs; i++) {
+		descs[jobs[i]->id - first_id].err = err;
+		destroy_job(jobs[i]);
+	}
+
+	if (copy_to_user(batch_buf, descs,
+			 batch_len * sizeof(struct jobdesc)))
+		err = -EFAULT;
+	else
+		err = queued;
+out:
+	cq_release(cq, efd);
+	kfree(descs);
+	kfree(jobs);
+
+	return err;
 }
 
-static int remove_queued_job(int id)
+/* empty every job queue, the jobs are discarded once unlocked */
+static void discard_queued_jobs(void)
 {
-	struct queue *q = NULL;
-	int err = -ENXIO;
+	struct jqueue *jq;
+	struct job *job, *tmp;
+	LIST_HEAD(jobs);
+	int i;
 
-	if (id < 0)
-		return -EINVAL;
+	for (i = 0; i < nr_jqueues; i++) {
+		jq = &jqueues[i];
+		mutex_lock(&jq->lock);
+		while ((job = remove_first_job(jq))) {
+			list_add_tail(&job->list, &jobs);
+			atomic_dec(&qlen);
+		}
+		mutex_unlock(&jq->lock);
+	}
 
-	mutex_lock(&qmutex);
-	INFO("removing job[%d]", id);
+	list_for_each_entry_safe(job, tmp, &jobs, list) {
+		list_del(&job->list);
+		discard_job(job);
+	}
+}
 
-	if (qlen > 0) {
-		q = remove_job(id);
-		if (q) {
-			qlen--;
-			destroy_job(q->job);
-			kfree(q);
-			err = 0;
-			INFO("job [%d] removed", id);
-			wake_up_all(&pwq);
-		}
+static int remove_queued_jobs(void)
+{
+	INFO("removing all...");
+
+	discard_queued_jobs();
+	wake_up_all(&pwq);
+	cancel_running();
+
+	return 0;
+}
+
+/* the queue job id is on, NULL if none. *pushed tells whether it is on
+ * the incoming stack of a queue instead, on its way to the lanes */
+static struct jqueue *job_queue(int id, bool *pushed)
+{
+	struct jqueue *jq = NULL;
+	struct job *job;
+
+	*pushed = false;
+	rcu_read_lock();
+	job = lookup_job(id);
+	if (job) {
+		jq = ACCESS_ONCE(job->jq);
+		*pushed = !jq && ACCESS_ONCE(job->state) == STATE_PENDING;
 	}
+	rcu_read_unlock();
 
-	mutex_unlock(&qmutex);
+	return jq;
+}
 
-	return err;
+/* take job id off its queue if it is queued, a job coalesced with it
+ * takes its slot. return the job, which the caller then owns. a job on
+ * jq stays around while jq->lock is held, so it is looked up again
+ * once the lock is taken */
+static struct job *unqueue_job(int id)
+{
+	struct jqueue *jq;
+	struct job *job, *next = NULL;
+	bool pushed;
+
+	jq = job_queue(id, &pushed);
+	if (pushed) {
+		flush_queues();
+		jq = job_queue(id, &pushed);
+	}
+	if (!jq)
+		return NULL;
+
+	mutex_lock(&jq->lock);
+	rcu_read_lock();
+	job = lookup_job(id);
+	if (job && remove_job(jq, job))
+		next = flight_promote(job);
+	else
+		job = NULL;
+	rcu_read_unlock();
+	if (next)
+		add2queue(jq, next);
+	mutex_unlock(&jq->lock);
+
+	if (job && !next) {
+		atomic_dec(&qlen);
+		wake_up_all(&pwq);
+	}
+
+	return job;
 }
 
-/* On success 1 is returned. On end of job lists, 0 is returned */
-static int list_queued_jobs(__user struct jobent *list_buf,
-			    int list_len)
+static int remove_queued_job(int id)
 {
-	int count = 0;
-	struct queue *q;
+	struct job *job;
+	bool detached;
 	int err = 0;
-	int name_len;
-	__user struct jobent *ent;
 
-	if (list_len <= 0)
+	if (id < 0)
 		return -EINVAL;
-	if (!access_ok(VERIFY_WRITE, list_buf,
-				list_len * sizeof(struct jobent)))
-		return -EFAULT;
 
-	mutex_lock(&qmutex);
-	INFO("listing...");
-
-	q = head;
-	while (q && count < list_len) {
-		ent = &list_buf[count];
-		name_len = strlen(q->job->infile);
-		if (name_len > NAME_MAX)
-			name_len = NAME_MAX;
-
-		__put_user(q->job->id, &ent->id);
-		__put_user(q->job->pid, &ent->pid);
-		__put_user(q->job->category, &ent->category);
-		__put_user(name_len, &ent->name_len);
-		if (__copy_to_user(ent->infile, q->job->infile,
-				   name_len)) {
-			err = -EFAULT; /* unknown err */
-			goto out;
-		}
-		__put_user(0, ent->infile + name_len);
+	INFO("removing job[%d]", id);
 
-		q = q->next;
-		count++;
+	job = unqueue_job(id);
+	detached = job != NULL;
+	if (!detached) {
+		rcu_read_lock();
+		job = lookup_job(id);
+		if (!job || job->state >= STATE_SUCCESS) {
+			err = -ENXIO;
+		} else if (flight_detach(job)) {
+			/* coalesced with another job and holding no slot */
+			detached = true;
+		} else {
+			/* not pushed yet, or being processed: it stops
+			 * before or at its next chunk */
+			job->cancel = CANCEL_JOB;
+			INFO("job [%d] canceled", id);
+		}
+		rcu_read_unlock();
 	}
 
-	if (q)
-		err = 1;
+	if (detached) {
+		discard_job(job);
+		INFO("job [%d] removed", id);
+	}
 
-	/* set id = 0 to suggest end of list */
-	if (count < list_len)
-		__put_user(0, &list_buf[count].id);
-out:
-	mutex_unlock(&qmutex);
 	return err;
 }
 
 asmlinkage static long xjob(__user void *args, int argslen)
 {
 	struct xargs *xarg = NULL;
+	struct jobdesc desc;
 	struct job *job = NULL;
+	struct xcq *cq;
+	struct eventfd_ctx *efd;
 	int err = 0;
 
 	/* check and copy user argument */
@@ -219,7 +483,23 @@ asmlinkage static long xjob(__user void *args, int argslen)
 		err = remove_queued_jobs();
 		goto out;
 	} else if (xarg->action == ACTION_LIST) {
-		err = list_queued_jobs(xarg->list_buf, xarg->list_len);
+		err = list_jobs(xarg->list_buf, xarg->list_len,
+				xarg->list_cursor, &xarg->filter);
+		goto out;
+	} else if (xarg->action == ACTION_SUBMIT_BATCH) {
+		err = submit_batch(xarg);
+		goto out;
+	} else if (xarg->action == ACTION_RING_SETUP) {
+		err = ring_setup(xarg->ring_params);
+		goto out;
+	} else if (xarg->action == ACTION_RING_ENTER) {
+		err = ring_enter(xarg->ring_fd);
+		goto out;
+	} else if (xarg->action == ACTION_CQ_SETUP) {
+		err = cq_setup();
+		goto out;
+	} else if (xarg->action == ACTION_STATUS) {
+		err = job_status(xarg->id, xarg->status_buf);
 		goto out;
 	} else if (xarg->action >= ACTION_LAST) {
 		err = -EINVAL;
@@ -227,16 +507,35 @@ asmlinkage static long xjob(__user void *args, int argslen)
 	}
 
 	/* init job */
-	job = kmalloc(sizeof(struct job), GFP_KERNEL);
+	job = alloc_job();
 	if (!job) {
 		err = -ENOMEM;
 		goto out;
 	}
-	err = init_job(job, xarg);
+	desc.id = xarg->id;
+	desc.category = xarg->category;
+	desc.algo = xarg->algo;
+	desc.oflags = xarg->oflags;
+	desc.flags = xarg->flags & XJOB_F_JOB;
+	desc.level = xarg->level;
+	desc.priority = xarg->priority;
+	desc.infile = xarg->infile;
+	desc.outfile = xarg->outfile;
+	err = init_job(job, &desc);
 	if (err)
 		goto out_err;
 
-	err = produce(job);
+	if (xarg->flags & XJOB_F_CQ) {
+		err = cq_get(xarg->cq_fd, &cq, &efd);
+		if (err)
+			goto out_err;
+		err = cq_bind(job, cq, efd);
+		cq_release(cq, efd);
+		if (err)
+			goto out_err;
+	}
+
+	err = produce(job, xarg->flags, xarg->timeout_ms);
 	if (err)
 		goto out_err;
 
@@ -253,67 +552,202 @@ out:
 	return err;
 }
 
-static void init_global(void)
+/* start or stop consumers until there are nr of them, a stopped consumer
+ * finishes its job first. grab consumer_lock first */
+static int set_consumers(int nr)
 {
+	struct task_struct **threads;
+	struct task_struct *t;
+
+	if (nr > num_consumer) {
+		threads = krealloc(cthreads, nr * sizeof(*threads), GFP_KERNEL);
+		if (!threads)
+			return -ENOMEM;
+		cthreads = threads;
+	}
+	while (num_consumer < nr) {
+		t = kthread_run(consume, (void *)num_consumer, "Consumer/%d",
+				num_consumer);
+		if (IS_ERR(t))
+			return PTR_ERR(t);
+		cthreads[num_consumer++] = t;
+	}
+	/* the last ones, so cids stay dense */
+	while (num_consumer > nr)
+		kthread_stop(cthreads[--num_consumer]);
+
+	return 0;
+}
+
+/* /sys/module/sys_xjob/parameters/qmax */
+static int set_qmax(const char *val, const struct kernel_param *kp)
+{
+	int n;
+	int err;
+
+	err = kstrtoint(val, 0, &n);
+	if (err)
+		return err;
+	if (n < 1)
+		return -EINVAL;
+
+	mutex_lock(&consumer_lock);
+	qmax = n;
+	if (started)
+		wake_up_all(&pwq); /* waiting producers may fit now */
+	mutex_unlock(&consumer_lock);
+
+	return 0;
+}
+
+static struct kernel_param_ops qmax_ops = {
+	.set = set_qmax,
+	.get = param_get_int,
+};
+module_param_cb(qmax, &qmax_ops, &qmax, 0644);
+MODULE_PARM_DESC(qmax, "max jobs queued over all queues");
+
+/* /sys/module/sys_xjob/parameters/num_consumer */
+static int set_num_consumer(const char *val, const struct kernel_param *kp)
+{
+	int n;
+	int err;
+
+	err = kstrtoint(val, 0, &n);
+	if (err)
+		return err;
+	if (n < 1 || n > CONSUMER_MAX)
+		return -EINVAL;
+
+	mutex_lock(&consumer_lock);
+	if (started) {
+		INFO("resizing consumers from %d to %d", num_consumer, n);
+		err = set_consumers(n);
+	} else {
+		init_consumers = n;
+	}
+	mutex_unlock(&consumer_lock);
+
+	return err;
+}
+
+static struct kernel_param_ops num_consumer_ops = {
+	.set = set_num_consumer,
+	.get = param_get_int,
+};
+module_param_cb(num_consumer, &num_consumer_ops, &num_consumer, 0644);
+MODULE_PARM_DESC(num_consumer, "consumer threads, one per cpu by default");
+
+static int init_global(void)
+{
+	int lane;
 	int i;
-	qlen = 0;
-	qmax = Q_MAX_SIZE;
-	head = NULL;
-	tail = NULL;
+	atomic_set(&qlen, 0);
 	should_stop = false;
 	curr_id = 0;
-	mutex_init(&qmutex);
 
 	init_waitqueue_head(&pwq);
 	init_waitqueue_head(&cwq);
 
-	if (nr_cpu_ids > Q_MAX_SIZE)
-		num_consumer = nr_cpu_ids;
+	nr_jqueues = nr_cpu_ids;
+	/* named caches, their usage shows up in /proc/slabinfo */
+	job_cachep = kmem_cache_create("xjob_job", sizeof(struct job), 0,
+				       SLAB_HWCACHE_ALIGN, NULL);
+	if (!job_cachep)
+		return -ENOMEM;
+	path_cachep = kmem_cache_create("xjob_path", PATH_CACHE_SIZE, 0, 0,
+					NULL);
+	if (!path_cachep)
+		goto out_job_cache;
+
+	proc_xjob = proc_mkdir("xjob", NULL);
+	if (!proc_xjob)
+		goto out_path_cache;
+	if (init_cache())
+		goto out_proc;
+	if (init_stats())
+		goto out_cache;
+
+	jqueues = kcalloc(nr_jqueues, sizeof(struct jqueue), GFP_KERNEL);
+	if (!jqueues)
+		goto out_stats;
+	for (i = 0; i < nr_jqueues; i++) {
+		mutex_init(&jqueues[i].lock);
+		jqueues[i].incoming = NULL;
+		for (lane = 0; lane < NR_LANES; lane++)
+			INIT_LIST_HEAD(&jqueues[i].lanes[lane]);
+	}
+
+	mutex_lock(&consumer_lock);
+	if (init_consumers)
+		i = init_consumers;
 	else if (nr_cpu_ids == 1)
-		num_consumer = 2; /* for demo */
+		i = 2; /* for demo */
 	else
-		num_consumer = nr_cpu_ids;
-	INFO("initializing %d consumers", num_consumer);
+		i = min_t(int, nr_cpu_ids, CONSUMER_MAX);
+	INFO("initializing %d consumers", i);
+	if (set_consumers(i)) {
+		set_consumers(0);
+		kfree(cthreads);
+		cthreads = NULL;
+		mutex_unlock(&consumer_lock);
+		goto out_jqueues;
+	}
+	started = true;
+	mutex_unlock(&consumer_lock);
 
-	cthreads = kmalloc(num_consumer * sizeof(struct task_struct *),
-			   GFP_KERNEL);
-	for (i = 0; i < num_consumer; i++)
-		cthreads[i] = kthread_run(consume, (void *)i, "Consumer/%d", i);
+	return 0;
+
+out_jqueues:
+	kfree(jqueues);
+out_stats:
+	destroy_stats();
+out_cache:
+	destroy_cache();
+out_proc:
+	remove_proc_entry("xjob", NULL);
+out_path_cache:
+	kmem_cache_destroy(path_cachep);
+out_job_cache:
+	kmem_cache_destroy(job_cachep);
+	return -ENOMEM;
 }
 
 static void destroy_global(void)
 {
-	struct queue *q;
-	int i;
-
 	INFO("destorying...");
 
-	mutex_lock(&qmutex);
-
 	should_stop = true;
 	wake_up_all(&pwq); /* wake up all producers */
 
 	/* wake up and stop all consumers */
-	for (i = 0; i < num_consumer; i++)
-		kthread_stop(cthreads[i]);
-
-	while (head) {
-		q = remove_first_job();
-		qlen--;
-		destroy_job(q->job);
-		kfree(q);
-	}
-
+	mutex_lock(&consumer_lock);
+	started = false;
+	set_consumers(0);
 	kfree(cthreads);
-
-	mutex_unlock(&qmutex);
+	cthreads = NULL;
+	mutex_unlock(&consumer_lock);
+
+	discard_queued_jobs();
+
+	kfree(jqueues);
+	destroy_stats();
+	destroy_cache();
+	remove_proc_entry("xjob", NULL);
+	rcu_barrier(); /* jobs freed by call_rcu() */
+	kmem_cache_destroy(path_cachep);
+	kmem_cache_destroy(job_cachep);
 }
 
 static int __init init_sys_xjob(void)
 {
+	int err;
+
 	INFO("installed new sys_xjob module");
 
-	init_global();
+	err = init_global();
+	if (err)
+		return err;
 
 	if (sysptr == NULL)
 		sysptr = xjob;
@@ -0,0 +1,168 @@
+#include "xjob.h"
+#ifndef XJOB_SHIM
+#include "xjob_trace.h"
+#endif
+
+/* the producer/consumer protocol over the job queues. how a job is
+ * processed is up to worker.c, so that qbench runs this file as is */
+
+/* queue as many of the jobs as there are free slots. return the number
+ * of jobs queued */
+static int __produce(struct job **jobs, int nr, int state, wait_queue_t *wait)
+{
+	struct jqueue *jq;
+	int n, i;
+
+	/* identical to a pending job: ride along with it, without a slot */
+	for (i = 0; i < nr && flight_join(jobs[i]); i++)
+		;
+	if (i)
+		return i;
+
+	n = reserve_slots(nr);
+	if (!n) {
+		prepare_to_wait_exclusive(&pwq, wait, state);
+		/* a consumer may free a slot before we are on pwq */
+		n = reserve_slots(nr);
+		if (!n)
+			return -EAGAIN;
+		finish_wait(&pwq, wait);
+	}
+
+	/* the jobs may be taken as soon as they are pushed */
+	for (i = 0; i < n; i++) {
+		flight_lead(jobs[i]);
+		trace_xjob_enqueue(jobs[i], 0);
+	}
+	jq = local_queue();
+	enqueue_jobs(jq, jobs, n);
+
+	/* pairs with the consumers going on cwq before they look again */
+	smp_mb();
+	if (waitqueue_active(&cwq))
+		wake_up_nr(&cwq, n); /* wake up one consumer per job */
+
+	return n;
+}
+
+/* the first *queued jobs are owned by the consumers on return,
+ * the rest still belong to the caller. when the queue is full, wait
+ * up to timeout_ms (0 forever) unless XJOB_F_NONBLOCK, killable only
+ * unless XJOB_F_INTR */
+int produce_batch(struct job **jobs, int nr, unsigned int flags,
+		  unsigned int timeout_ms, int *queued)
+{
+	int state = flags & XJOB_F_INTR ? TASK_INTERRUPTIBLE : TASK_KILLABLE;
+	long timeout = timeout_ms ? msecs_to_jiffies(timeout_ms) :
+		MAX_SCHEDULE_TIMEOUT;
+	int err = 0;
+	int n;
+	DEFINE_WAIT(wait);
+
+	for (n = 0; n < nr; n++) {
+		stat_infile(jobs[n]);
+		trace_xjob_submit(jobs[n], 0);
+	}
+	index_jobs(jobs, nr);
+
+	*queued = 0;
+	while (*queued < nr) {
+		n = __produce(jobs + *queued, nr - *queued, state, &wait);
+		if (n > 0) {
+			*queued += n;
+			continue;
+		}
+		/* entered the wait queue */
+		if (flags & XJOB_F_NONBLOCK) {
+			err = -EAGAIN;
+			break;
+		}
+		if (!timeout) {
+			err = -ETIMEDOUT;
+			break;
+		}
+		trace_xjob_producer_block(jobs[*queued], 0);
+		stat_producer_block();
+		timeout = schedule_timeout(timeout);
+		/* during rmmod, we should stop producing or sleeping */
+		if (should_stop) {
+			err = -EBUSY;
+			break;
+		}
+		if (signal_pending_state(state, current)) {
+			err = -EINTR;
+			break;
+		}
+	}
+	finish_wait(&pwq, &wait);
+	/* we may have taken the wake up of a slot we give up on */
+	if (err && atomic_read(&qlen) < qmax)
+		wake_up(&pwq);
+
+	return err;
+}
+
+int produce(struct job *job, unsigned int flags, unsigned int timeout_ms)
+{
+	int queued;
+
+	return produce_batch(&job, 1, flags, timeout_ms, &queued);
+}
+
+static int __consume(wait_queue_t *wait, int cid)
+{
+	ktime_t start = ktime_get();
+	struct job *job;
+	int ret;
+
+	/* finish the running tree jobs before starting new ones */
+	if (hash_tree_leaf()) {
+		stat_busy(cid, start);
+		return 0;
+	}
+
+	job = dequeue_job(cid);
+	if (!job) {
+		prepare_to_wait_exclusive(&cwq, wait, TASK_INTERRUPTIBLE);
+		/* kthread_stop() may have woken us before we were on cwq */
+		if (tree_pending() || kthread_should_stop()) {
+			finish_wait(&cwq, wait);
+			return 0;
+		}
+		/* a producer may queue a job before we are on cwq */
+		job = dequeue_job(cid);
+		if (!job) {
+			pr_debug("Consumer/%d: waiting\n", cid);
+			return 0;
+		}
+		finish_wait(&cwq, wait);
+	}
+	release_slot();
+	trace_xjob_dequeue(job, 0);
+
+	ret = process_job(job, cid);
+
+	return ret;
+}
+
+int consume(void *data)
+{
+	int cid = (long)data;
+	DEFINE_WAIT(wait);
+	INFO("Consumer/%d: Initialized!", cid);
+	stat_consumer_start(cid);
+	while (1) {
+		__consume(&wait, cid);
+		schedule();
+		/* if wake up by kthread_stop, do not fall asleep again
+		 * absence of "should_stop" will cause problem during rmmod */
+		if (should_stop || kthread_should_stop())
+			break;
+	}
+	/* stopped while on cwq, pass on a wake up meant for us */
+	finish_wait(&cwq, &wait);
+	if (atomic_read(&qlen))
+		wake_up(&cwq);
+
+	return 0;
+}
@@ -0,0 +1,354 @@
+#include "xjob.h"
+#include <unistd.h>
+#include <string.h>
+
+/* queue.c, protocol.c and flight.c in userspace, for contention
+ * experiments under perf without the module. what they call into
+ * elsewhere is stubbed below, keeping the locks it takes */
+
+struct jqueue *jqueues;
+int nr_jqueues;
+atomic_t qlen;
+int qmax = Q_MAX_SIZE;
+wait_queue_head_t pwq;
+wait_queue_head_t cwq;
+bool should_stop;
+__thread struct task_struct *shim_task;
+
+int nr_producers = 4;
+int nr_consumers = 4;
+int jobs_per_producer = 100000;
+int batch = 1;
+int work;		/* spins per job */
+bool priorities;	/* random priority classes, else all normal */
+bool remove_mode;
+
+atomic_t producer_blocks;
+atomic_t consumed;
+int qlen_high;
+
+/* stats.c, per cpu but for the queue length */
+void stat_qlen(int len)
+{
+	int high = ACCESS_ONCE(qlen_high);
+
+	while (len > high && cmpxchg(&qlen_high, high, len) != high)
+		high = ACCESS_ONCE(qlen_high);
+}
+
+void stat_producer_block(void)
+{
+	atomic_inc(&producer_blocks);
+}
+
+void stat_infile(struct job *job)
+{
+}
+
+void stat_busy(int cid, ktime_t start)
+{
+}
+
+void stat_consumer_start(int cid)
+{
+}
+
+/* crypto.c, no tree jobs */
+bool hash_tree_leaf(void)
+{
+	return false;
+}
+
+bool tree_pending(void)
+{
+	return false;
+}
+
+/* index.c, a slot by id stands in for the radix tree */
+#define INDEX_SIZE 4096
+struct job *index_table[INDEX_SIZE];
+DEFINE_SPINLOCK(index_lock);
+
+void index_jobs(struct job **jobs, int nr)
+{
+	int i;
+
+	spin_lock(&index_lock);
+	for (i = 0; i < nr; i++)
+		index_table[jobs[i]->id % INDEX_SIZE] = jobs[i];
+	spin_unlock(&index_lock);
+}
+
+bool unindex_job(struct job *job)
+{
+	bool indexed;
+
+	spin_lock(&index_lock);
+	indexed = index_table[job->id % INDEX_SIZE] == job;
+	if (indexed)
+		index_table[job->id % INDEX_SIZE] = NULL;
+	spin_unlock(&index_lock);
+
+	return indexed;
+}
+
+void usage()
+{
+	printf("usage: qbench [flags]\n");
+	printf("\n");
+	printf(" flags:\n");
+	printf(" -p N: producers(%d)\n", nr_producers);
+	printf(" -c N: consumers(%d)\n", nr_consumers);
+	printf(" -n N: jobs per producer(%d)\n", jobs_per_producer);
+	printf(" -b N: jobs per produce call(%d)\n", batch);
+	printf(" -q N: qmax(%d)\n", qmax);
+	printf(" -Q N: job queues(one per cpu)\n");
+	printf(" -w N: spins per job in the consumers(%d)\n", work);
+	printf(" -P: random priority classes\n");
+	printf(" -I: producers push to the incoming stacks, incoming_push\n");
+	printf(" -R: time remove_job and remove_first_job on -n jobs\n"
+	       "     queued by one thread instead\n");
+	printf(" -h: print this usage\n");
+}
+
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* an infile of its own, so that no job joins another */
+struct job *new_job(int id, unsigned int *seed)
+{
+	struct job *job = calloc(1, sizeof(struct job));
+
+	if (!job || asprintf(&job->paths, "/bench/%d", id) < 0)
+		abort();
+	job->id = id;
+	job->category = CATEGORY_CHECKSUM;
+	job->infile = job->paths;
+	job->priority = priorities ?
+		PRIORITY_LOW + rand_r(seed) % (PRIORITY_LAST - PRIORITY_LOW) :
+		PRIORITY_NORMAL;
+	job->size = (loff_t)(rand_r(seed) % 4096) << 10;
+	INIT_LIST_HEAD(&job->list);
+	INIT_HLIST_NODE(&job->flight);
+	INIT_LIST_HEAD(&job->followers);
+
+	return job;
+}
+
+void free_job(struct job *job)
+{
+	free(job->paths);
+	free(job);
+}
+
+/* process_job() of worker.c, the locks are those of destroy_job() */
+int process_job(struct job *job, int cid)
+{
+	LIST_HEAD(followers);
+	volatile int spin;
+
+	for (spin = 0; spin < work; spin++)
+		;
+	flight_end(job, &followers);
+	unindex_job(job);
+	free_job(job);
+	atomic_inc(&consumed);
+
+	return 0;
+}
+
+void *producer(void *arg)
+{
+	long pid = (long)arg;
+	unsigned int seed = pid + 1;
+	struct job *jobs[JOB_BATCH_MAX];
+	int i, n, queued;
+
+	for (i = 0; i < jobs_per_producer; i += n) {
+		for (n = 0; n < batch && i + n < jobs_per_producer; n++)
+			jobs[n] = new_job(pid * jobs_per_producer + i + n + 1,
+					  &seed);
+		produce_batch(jobs, n, 0, 0, &queued);
+	}
+
+	return NULL;
+}
+
+void bench_queue(void)
+{
+	struct task_struct **consumers;
+	pthread_t *producers;
+	long total = (long)nr_producers * jobs_per_producer;
+	double start, secs;
+	long i;
+
+	consumers = calloc(nr_consumers, sizeof(*consumers));
+	producers = calloc(nr_producers, sizeof(*producers));
+	if (!consumers || !producers)
+		abort();
+
+	start = now();
+	for (i = 0; i < nr_consumers; i++)
+		consumers[i] = kthread_run(consume, (void *)i, "Consumer/%ld",
+					   i);
+	for (i = 0; i < nr_producers; i++) {
+		if (pthread_create(&producers[i], NULL, producer, (void *)i))
+			abort();
+	}
+	for (i = 0; i < nr_producers; i++)
+		pthread_join(producers[i], NULL);
+	while (atomic_read(&consumed) < total)
+		usleep(1000);
+	secs = now() - start;
+	for (i = 0; i < nr_consumers; i++)
+		kthread_stop(consumers[i]);
+
+	printf("push,producers,consumers,jobs,batch,qmax,queues,secs,"
+	       "jobs_per_sec,producer_blocks,qlen_high\n");
+	printf("%s,%d,%d,%ld,%d,%d,%d,%.3f,%.0f,%d,%d\n",
+	       incoming_push ? "incoming" : "lock", nr_producers, nr_consumers,
+	       total, batch, qmax, nr_jqueues, secs, total / secs,
+	       atomic_read(&producer_blocks), qlen_high);
+
+	free(consumers);
+	free(producers);
+}
+
+/* ACTION_REMOVE_ONE, once the job is looked up by id */
+void bench_remove(void)
+{
+	struct jqueue *jq;
+	struct job **jobs;
+	struct job *job;
+	unsigned int seed = 1;
+	int nr = jobs_per_producer;
+	double start, remove_secs, drain_secs;
+	int i, k;
+
+	jobs = malloc(nr * sizeof(struct job *));
+	if (!jobs)
+		abort();
+	for (i = 0; i < nr; i++) {
+		jobs[i] = new_job(i + 1, &seed);
+		jq = &jqueues[i % nr_jqueues];
+		add2queue(jq, jobs[i]);
+	}
+	/* shuffle, half of them are removed */
+	for (i = nr - 1; i > 0; i--) {
+		k = rand_r(&seed) % (i + 1);
+		job = jobs[i];
+		jobs[i] = jobs[k];
+		jobs[k] = job;
+	}
+
+	start = now();
+	for (i = 0; i < nr / 2; i++) {
+		jq = jobs[i]->jq;
+		mutex_lock(&jq->lock);
+		if (!remove_job(jq, jobs[i]))
+			abort();
+		mutex_unlock(&jq->lock);
+		free_job(jobs[i]);
+	}
+	remove_secs = now() - start;
+
+	start = now();
+	for (k = 0; k < nr_jqueues; k++) {
+		jq = &jqueues[k];
+		mutex_lock(&jq->lock);
+		while ((job = remove_first_job(jq)))
+			free_job(job);
+		mutex_unlock(&jq->lock);
+	}
+	drain_secs = now() - start;
+
+	printf("jobs,queues,remove_job_ns,remove_first_job_ns\n");
+	printf("%d,%d,%.0f,%.0f\n", nr, nr_jqueues,
+	       remove_secs * 1e9 / (nr / 2 ? nr / 2 : 1),
+	       drain_secs * 1e9 / (nr - nr / 2 ? nr - nr / 2 : 1));
+
+	free(jobs);
+}
+
+int main(int argc, char *argv[])
+{
+	int lane;
+	int ch;
+	int i;
+
+	nr_jqueues = sysconf(_SC_NPROCESSORS_CONF);
+	while ((ch = getopt(argc, argv, "IPQ:Rb:c:hn:p:q:w:")) != -1) {
+		switch (ch) {
+		case 'p':
+			nr_producers = strtol(optarg, 0, 10);
+			break;
+		case 'c':
+			nr_consumers = strtol(optarg, 0, 10);
+			break;
+		case 'n':
+			jobs_per_producer = strtol(optarg, 0, 10);
+			break;
+		case 'b':
+			batch = strtol(optarg, 0, 10);
+			break;
+		case 'q':
+			qmax = strtol(optarg, 0, 10);
+			break;
+		case 'Q':
+			nr_jqueues = strtol(optarg, 0, 10);
+			break;
+		case 'w':
+			work = strtol(optarg, 0, 10);
+			break;
+		case 'P':
+			priorities = true;
+			break;
+		case 'R':
+			remove_mode = true;
+			break;
+		case 'I':
+			incoming_push = 1;
+			break;
+		case 'h':
+		case '?':
+		default:
+			usage();
+			exit(1);
+			break;
+		}
+	}
+	if (nr_producers <= 0 || nr_consumers <= 0 || jobs_per_producer <= 0 ||
+	    batch <= 0 || batch > JOB_BATCH_MAX || qmax <= 0 ||
+	    nr_jqueues <= 0 || work < 0) {
+		usage();
+		exit(1);
+	}
+
+	/* init_global() of main.c */
+	atomic_set(&qlen, 0);
+	init_waitqueue_head(&pwq);
+	init_waitqueue_head(&cwq);
+	jqueues = calloc(nr_jqueues, sizeof(struct jqueue));
+	if (!jqueues)
+		abort();
+	for (i = 0; i < nr_jqueues; i++) {
+		mutex_init(&jqueues[i].lock);
+		jqueues[i].incoming = NULL;
+		for (lane = 0; lane < NR_LANES; lane++)
+			INIT_LIST_HEAD(&jqueues[i].lanes[lane]);
+	}
+
+	if (remove_mode)
+		bench_remove();
+	else
+		bench_queue();
+
+	free(jqueues);
+
+	return 0;
+}
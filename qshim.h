@@ -0,0 +1,439 @@
+#ifndef _QSHIM_H_
+#define _QSHIM_H_
+
+/* just enough of the kernel, on top of pthreads, to build queue.c,
+ * protocol.c and flight.c in userspace */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+typedef unsigned char u8;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef long long s64;
+typedef s64 ktime_t;
+
+struct inode;
+struct file;
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *);
+};
+
+#define __user
+#define asmlinkage
+#define KERN_DEFAULT ""
+/* stdout is for results */
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...) do { } while (0)
+#define module_param(name, type, perm) extern int __shim_param_##name
+#define MODULE_PARM_DESC(name, desc) extern int __shim_desc_##name
+
+#define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define min(x, y) ({ typeof(x) _x = (x); typeof(y) _y = (y); \
+		     _x < _y ? _x : _y; })
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* cpu */
+static inline int raw_smp_processor_id(void)
+{
+	int cpu = sched_getcpu();
+
+	return cpu < 0 ? 0 : cpu;
+}
+
+/* jiffies, HZ is 1000 */
+static inline unsigned long shim_jiffies(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+#define jiffies shim_jiffies()
+#define msecs_to_jiffies(ms) ((unsigned long)(ms))
+#define time_after_eq(a, b) ((long)((a) - (b)) >= 0)
+#define time_before(a, b) ((long)((a) - (b)) < 0)
+#define time_before_eq(a, b) ((long)((a) - (b)) <= 0)
+#define time_in_range(a, b, c) (time_after_eq(a, b) && time_before_eq(a, c))
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* atomics */
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define atomic_read(v) ACCESS_ONCE((v)->counter)
+#define atomic_set(v, i) ((v)->counter = (i))
+#define atomic_inc(v) __sync_fetch_and_add(&(v)->counter, 1)
+#define atomic_dec(v) __sync_fetch_and_sub(&(v)->counter, 1)
+#define atomic_cmpxchg(v, old, new) \
+	__sync_val_compare_and_swap(&(v)->counter, old, new)
+#define cmpxchg(ptr, old, new) __sync_val_compare_and_swap(ptr, old, new)
+#define xchg(ptr, v) __atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST)
+#define smp_mb() __sync_synchronize()
+#define smp_mb__after_atomic_dec() smp_mb()
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add_tail(struct list_head *new,
+				 struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD(entry);
+}
+#define list_del list_del_init
+
+static inline void list_move_tail(struct list_head *list,
+				  struct list_head *head)
+{
+	list_del(list);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return ACCESS_ONCE(head->next) == head;
+}
+
+static inline void list_splice_init(struct list_head *list,
+				    struct list_head *head)
+{
+	if (list_empty(list))
+		return;
+	list->next->prev = head;
+	list->prev->next = head->next;
+	head->next->prev = list->prev;
+	head->next = list->next;
+	INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member); \
+	     &pos->member != (head); \
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+#define list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member), \
+	     n = list_entry(pos->member.next, typeof(*pos), member); \
+	     &pos->member != (head); \
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+#define INIT_HLIST_NODE(h) ((h)->next = NULL, (h)->pprev = NULL)
+#define hlist_unhashed(h) (!(h)->pprev)
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	n->next = h->first;
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del_init(struct hlist_node *n)
+{
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+	INIT_HLIST_NODE(n);
+}
+
+#define hlist_entry(ptr, type, member) container_of(ptr, type, member)
+#define hlist_for_each_entry(tpos, pos, head, member) \
+	for (pos = (head)->first; \
+	     pos && ((tpos = hlist_entry(pos, typeof(*tpos), member)), 1); \
+	     pos = pos->next)
+
+/* hashes */
+static inline unsigned int full_name_hash(const char *name, unsigned int len)
+{
+	unsigned int hash = 0;
+	unsigned char c;
+
+	while (len--) {
+		c = *name++;
+		hash = (hash + (c << 4) + (c >> 4)) * 11;
+	}
+	return hash;
+}
+
+#define hash_32(val, bits) ((u32)((val) * 0x9e370001U) >> (32 - (bits)))
+
+/* mutex */
+struct mutex {
+	pthread_mutex_t m;
+};
+
+#define mutex_init(lock) pthread_mutex_init(&(lock)->m, NULL)
+#define mutex_lock(lock) pthread_mutex_lock(&(lock)->m)
+#define mutex_unlock(lock) pthread_mutex_unlock(&(lock)->m)
+
+/* spinlocks, a spinning holder could be preempted here */
+typedef struct {
+	pthread_mutex_t m;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(name) spinlock_t name = { PTHREAD_MUTEX_INITIALIZER }
+#define spin_lock(lock) pthread_mutex_lock(&(lock)->m)
+#define spin_unlock(lock) pthread_mutex_unlock(&(lock)->m)
+
+/* tasks, every thread gets one when it first needs it */
+#define TASK_RUNNING 0
+#define TASK_INTERRUPTIBLE 1
+#define TASK_UNINTERRUPTIBLE 2
+#define TASK_KILLABLE TASK_UNINTERRUPTIBLE /* no signals here */
+#define MAX_SCHEDULE_TIMEOUT LONG_MAX
+
+struct task_struct {
+	pthread_mutex_t lock;	/* protect state */
+	pthread_cond_t wake;
+	int state;
+	bool should_stop;
+	pthread_t thread;
+	int (*fn)(void *);
+	void *data;
+};
+
+extern __thread struct task_struct *shim_task;
+
+static inline struct task_struct *shim_new_task(void)
+{
+	struct task_struct *t = calloc(1, sizeof(struct task_struct));
+
+	if (!t)
+		abort();
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->wake, NULL);
+	return t;
+}
+
+static inline struct task_struct *shim_current(void)
+{
+	if (!shim_task)
+		shim_task = shim_new_task();
+	return shim_task;
+}
+#define current shim_current()
+
+static inline void set_task_state(struct task_struct *t, int state)
+{
+	pthread_mutex_lock(&t->lock);
+	t->state = state;
+	pthread_mutex_unlock(&t->lock);
+}
+
+/* 1 if t was sleeping, or about to */
+static inline int wake_up_process(struct task_struct *t)
+{
+	int woken;
+
+	pthread_mutex_lock(&t->lock);
+	woken = t->state != TASK_RUNNING;
+	t->state = TASK_RUNNING;
+	pthread_cond_signal(&t->wake);
+	pthread_mutex_unlock(&t->lock);
+
+	return woken;
+}
+
+/* sleep until woken, unless woken since the state was set */
+static inline long schedule_timeout(long timeout)
+{
+	struct task_struct *t = current;
+	struct timespec ts;
+	unsigned long end = jiffies + timeout;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += timeout % 1000 * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&t->lock);
+	while (t->state != TASK_RUNNING) {
+		if (timeout == MAX_SCHEDULE_TIMEOUT)
+			pthread_cond_wait(&t->wake, &t->lock);
+		else if (pthread_cond_timedwait(&t->wake, &t->lock, &ts))
+			t->state = TASK_RUNNING; /* timed out */
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	if (timeout == MAX_SCHEDULE_TIMEOUT)
+		return timeout;
+	timeout = end - jiffies;
+	return timeout > 0 ? timeout : 0;
+}
+
+static inline void schedule(void)
+{
+	schedule_timeout(MAX_SCHEDULE_TIMEOUT);
+}
+
+#define signal_pending_state(state, t) 0
+
+/* wait queues, entries are removed when woken as with DEFINE_WAIT */
+typedef struct {
+	pthread_mutex_t lock;
+	struct list_head head;
+} wait_queue_head_t;
+
+typedef struct {
+	struct task_struct *task;
+	int exclusive;
+	struct list_head list;
+} wait_queue_t;
+
+#define DEFINE_WAIT(name) \
+	wait_queue_t name = { NULL, 0, LIST_HEAD_INIT(name.list) }
+
+static inline void init_waitqueue_head(wait_queue_head_t *q)
+{
+	pthread_mutex_init(&q->lock, NULL);
+	INIT_LIST_HEAD(&q->head);
+}
+
+static inline void prepare_to_wait_exclusive(wait_queue_head_t *q,
+					     wait_queue_t *wait, int state)
+{
+	wait->task = current;
+	wait->exclusive = 1;
+	pthread_mutex_lock(&q->lock);
+	if (list_empty(&wait->list))
+		list_add_tail(&wait->list, &q->head);
+	set_task_state(wait->task, state);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static inline void finish_wait(wait_queue_head_t *q, wait_queue_t *wait)
+{
+	set_task_state(current, TASK_RUNNING);
+	if (!list_empty(&wait->list)) {
+		pthread_mutex_lock(&q->lock);
+		list_del_init(&wait->list);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+#define waitqueue_active(q) (!list_empty(&(q)->head))
+
+/* wake up every non exclusive waiter and nr exclusive ones, 0 for all */
+static inline void wake_up_nr(wait_queue_head_t *q, int nr)
+{
+	wait_queue_t *wait, *tmp;
+
+	pthread_mutex_lock(&q->lock);
+	list_for_each_entry_safe(wait, tmp, &q->head, list) {
+		if (!wake_up_process(wait->task))
+			continue;
+		list_del_init(&wait->list);
+		if (wait->exclusive && !--nr)
+			break;
+	}
+	pthread_mutex_unlock(&q->lock);
+}
+#define wake_up(q) wake_up_nr(q, 1)
+#define wake_up_all(q) wake_up_nr(q, 0)
+
+/* kthreads */
+static inline void *shim_kthread(void *arg)
+{
+	shim_task = arg;
+	shim_task->fn(shim_task->data);
+	return NULL;
+}
+
+static inline struct task_struct *kthread_run(int (*fn)(void *), void *data,
+					      const char *name, ...)
+{
+	struct task_struct *t = shim_new_task();
+
+	t->fn = fn;
+	t->data = data;
+	if (pthread_create(&t->thread, NULL, shim_kthread, t))
+		abort();
+	return t;
+}
+
+static inline bool kthread_should_stop(void)
+{
+	return ACCESS_ONCE(current->should_stop);
+}
+
+static inline int kthread_stop(struct task_struct *t)
+{
+	t->should_stop = true;
+	wake_up_process(t);
+	pthread_join(t->thread, NULL);
+	pthread_mutex_destroy(&t->lock);
+	pthread_cond_destroy(&t->wake);
+	free(t);
+	return 0;
+}
+
+/* xjob_trace.h, as with the tracepoints off */
+#define trace_xjob_submit(job, err) do { } while (0)
+#define trace_xjob_enqueue(job, err) do { } while (0)
+#define trace_xjob_producer_block(job, err) do { } while (0)
+#define trace_xjob_dequeue(job, err) do { } while (0)
+
+#endif	/* not _QSHIM_H_ */
@@ -0,0 +1,313 @@
+#include "xjob.h"
+
+/* the job queues and the slot budget they share. no other kernel
+ * facility is used here, so it also builds in userspace, see qbench.c */
+
+/* a queued job moves up one lane after waiting this long in its lane */
+static unsigned int prio_aging_ms = 2000;
+module_param(prio_aging_ms, uint, 0644);
+MODULE_PARM_DESC(prio_aging_ms, "ms before a queued job gains a priority "
+		 "class, 0 disables aging");
+
+/* shortest job first: small jobs are served before large ones of the
+ * same priority, except by the first large_consumers consumers */
+#define SCHED_FIFO_POLICY 0
+#define SCHED_SJF_POLICY 1
+static unsigned int sched_policy = SCHED_FIFO_POLICY;
+module_param(sched_policy, uint, 0644);
+MODULE_PARM_DESC(sched_policy, "0 for FIFO, 1 for shortest job first");
+
+static unsigned int sjf_small_kb = 1024;
+module_param(sjf_small_kb, uint, 0644);
+MODULE_PARM_DESC(sjf_small_kb, "infiles up to this size are small jobs");
+
+static unsigned int large_consumers = 1;
+module_param(large_consumers, uint, 0644);
+MODULE_PARM_DESC(large_consumers, "consumers serving large jobs first");
+
+/* experimental: producers push their jobs on the incoming stack of
+ * their queue instead of taking its lock. only measured on a single cpu
+ * so far, see qbench -I before turning it on */
+unsigned int incoming_push;
+module_param(incoming_push, uint, 0644);
+MODULE_PARM_DESC(incoming_push, "experimental, not measured on multi-core: "
+		 "1 to queue jobs without the queue lock");
+
+static unsigned long next_aging; /* jiffies */
+
+/* reserve up to nr slots of the global queue budget, shared by all job
+ * queues. return the number of slots reserved */
+int reserve_slots(int nr)
+{
+	int len = atomic_read(&qlen);
+	int old, n;
+
+	while (len < qmax) {
+		n = min(nr, qmax - len);
+		old = atomic_cmpxchg(&qlen, len, len + n);
+		if (old == len) {
+			stat_qlen(len + n);
+			return n;
+		}
+		len = old;
+	}
+
+	return 0;
+}
+
+void release_slot(void)
+{
+	atomic_dec(&qlen);
+	smp_mb__after_atomic_dec();
+	if (waitqueue_active(&pwq))
+		wake_up(&pwq); /* wake up one producer */
+}
+
+/* queue of the cpu we are running on, may change right after */
+struct jqueue *local_queue(void)
+{
+	return &jqueues[raw_smp_processor_id() % nr_jqueues];
+}
+
+/* grab jq->lock first */
+static void unlink_job(struct jqueue *jq, struct job *job)
+{
+	list_del(&job->list);
+	jq->nr[job->lane]--;
+	jq->len--;
+	job->jq = NULL;
+}
+
+static struct job *take_job(struct jqueue *jq, int lane)
+{
+	struct job *job;
+
+	job = list_first_entry(&jq->lanes[lane], struct job, list);
+	unlink_job(jq, job);
+
+	return job;
+}
+
+/* move the jobs which waited too long in their lane up: a large job to
+ * the small lane, a small one to the large lane of the next priority.
+ * without SJF the large lanes are unused and skipped */
+static void age_queue(struct jqueue *jq, unsigned long age)
+{
+	int step = sched_policy == SCHED_SJF_POLICY ? 1 : 2;
+	struct job *job;
+	int lane, to;
+
+	/* top down, a job moves up at most once per pass */
+	for (lane = NR_LANES - 2; lane >= 0; lane--) {
+		to = min(lane + step, NR_LANES - 1);
+		while (jq->nr[lane]) {
+			job = list_first_entry(&jq->lanes[lane], struct job,
+					       list);
+			if (time_before(jiffies, job->queued_at + age))
+				break;
+			list_move_tail(&job->list, &jq->lanes[to]);
+			jq->nr[lane]--;
+			jq->nr[to]++;
+			job->lane = to;
+			job->queued_at = jiffies;
+		}
+	}
+}
+
+/* age all the queues, by one consumer at a time, a few times per
+ * aging period, so no job can be starved by higher classes */
+static void age_jobs(void)
+{
+	unsigned long age = msecs_to_jiffies(ACCESS_ONCE(prio_aging_ms));
+	unsigned long period = age / 4 + 1;
+	unsigned long next = ACCESS_ONCE(next_aging);
+	struct jqueue *jq;
+	int i;
+
+	/* not due in the period ending at next, a stale next is due */
+	if (!age || time_in_range(jiffies, next - period, next - 1))
+		return;
+	if (cmpxchg(&next_aging, next, jiffies + period) != next)
+		return;
+
+	for (i = 0; i < nr_jqueues; i++) {
+		jq = &jqueues[i];
+		if (!ACCESS_ONCE(jq->len))
+			continue;
+		mutex_lock(&jq->lock);
+		age_queue(jq, age);
+		mutex_unlock(&jq->lock);
+	}
+}
+
+/* move the jobs pushed by producers to their lanes, in the order they
+ * were pushed. grab jq->lock first */
+static void flush_incoming(struct jqueue *jq)
+{
+	struct push_node *node = xchg(&jq->incoming, NULL);
+	struct push_node *prev = NULL;
+	struct push_node *next;
+	struct job *job;
+
+	/* newest first, reverse it */
+	while (node) {
+		next = node->next;
+		node->next = prev;
+		prev = node;
+		node = next;
+	}
+	while (prev) {
+		job = container_of(prev, struct job, push);
+		prev = prev->next;
+		add2queue(jq, job);
+	}
+}
+
+/* move the jobs pushed on every queue to their lanes, for removal */
+void flush_queues(void)
+{
+	struct jqueue *jq;
+	int i;
+
+	for (i = 0; i < nr_jqueues; i++) {
+		jq = &jqueues[i];
+		if (!ACCESS_ONCE(jq->incoming))
+			continue;
+		mutex_lock(&jq->lock);
+		flush_incoming(jq);
+		mutex_unlock(&jq->lock);
+	}
+}
+
+/* no job in any lane: take the first job pushed on another queue, only
+ * that queue is flushed */
+static struct job *steal_pushed(int cid)
+{
+	struct jqueue *jq;
+	struct job *job = NULL;
+	int i;
+
+	for (i = 1; i < nr_jqueues && !job; i++) {
+		jq = &jqueues[(cid + i) % nr_jqueues];
+		if (!ACCESS_ONCE(jq->incoming))
+			continue;
+
+		mutex_lock(&jq->lock);
+		job = remove_first_job(jq);
+		mutex_unlock(&jq->lock);
+	}
+
+	return job;
+}
+
+/* take a job of the highest priority lane, from our own queue first,
+ * then steal from the others */
+struct job *dequeue_job(int cid)
+{
+	struct jqueue *jq;
+	struct job *job = NULL;
+	bool large_first;
+	int lane;
+	int i, k;
+
+	age_jobs();
+
+	/* only our own pushed jobs join the lanes here, those of the other
+	 * queues are left to their own consumers until we run out */
+	jq = &jqueues[cid % nr_jqueues];
+	if (ACCESS_ONCE(jq->incoming)) {
+		mutex_lock(&jq->lock);
+		flush_incoming(jq);
+		mutex_unlock(&jq->lock);
+	}
+
+	/* large jobs always have some consumers, whatever the small ones */
+	large_first = sched_policy == SCHED_SJF_POLICY &&
+		cid < large_consumers;
+
+	for (k = NR_LANES - 1; k >= 0 && !job; k--) {
+		lane = large_first ? k ^ 1 : k; /* large lane of the pair first */
+		for (i = 0; i < nr_jqueues && !job; i++) {
+			jq = &jqueues[(cid + i) % nr_jqueues];
+			if (!ACCESS_ONCE(jq->nr[lane]))
+				continue;
+
+			mutex_lock(&jq->lock);
+			if (jq->nr[lane])
+				job = take_job(jq, lane);
+			mutex_unlock(&jq->lock);
+		}
+	}
+	if (!job)
+		job = steal_pushed(cid);
+
+	return job;
+}
+
+/* queue jobs under jq->lock, or with incoming_push without it, a single
+ * cmpxchg for all of them. the caller then wakes up the consumers */
+void enqueue_jobs(struct jqueue *jq, struct job **jobs, int nr)
+{
+	struct push_node *first;
+	int i;
+
+	if (!nr)
+		return;
+
+	if (!ACCESS_ONCE(incoming_push)) {
+		mutex_lock(&jq->lock);
+		for (i = 0; i < nr; i++)
+			add2queue(jq, jobs[i]);
+		mutex_unlock(&jq->lock);
+		return;
+	}
+
+	/* linked newest first, as flush_incoming() expects */
+	for (i = 0; i < nr; i++) {
+		jobs[i]->state = STATE_PENDING;
+		jobs[i]->push.next = i ? &jobs[i - 1]->push : NULL;
+	}
+	do {
+		first = ACCESS_ONCE(jq->incoming);
+		jobs[0]->push.next = first;
+	} while (cmpxchg(&jq->incoming, first, &jobs[nr - 1]->push) != first);
+}
+
+/* to invoke the queue functions below, grab jq->lock first */
+void add2queue(struct jqueue *jq, struct job *job)
+{
+	bool large = sched_policy == SCHED_SJF_POLICY &&
+		job->size > (loff_t)sjf_small_kb << 10;
+
+	job->lane = LANE(job->priority, large ? LANE_LARGE : LANE_SMALL);
+	job->queued_at = jiffies;
+	job->jq = jq;
+	job->state = STATE_PENDING;
+	list_add_tail(&job->list, &jq->lanes[job->lane]);
+	jq->nr[job->lane]++;
+	jq->len++;
+}
+
+/* the first job of the highest non-empty lane, NULL if none */
+struct job *remove_first_job(struct jqueue *jq)
+{
+	int lane = NR_LANES - 1;
+
+	flush_incoming(jq);
+	if (!jq->len)
+		return NULL;
+	while (!jq->nr[lane])
+		lane--;
+
+	return take_job(jq, lane);
+}
+
+/* false if job is not on jq (any more) */
+bool remove_job(struct jqueue *jq, struct job *job)
+{
+	if (job->jq != jq)
+		return false;
+	unlink_job(jq, job);
+
+	return true;
+}
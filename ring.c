@@ -0,0 +1,376 @@
+#include "xjob.h"
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+
+#define RING_IDLE_MS 1000
+#define RING_SUBMIT_BATCH 32 /* sqes moved to the job queues at a time */
+
+/* shared submission/completion rings of one client.
+ * the client fills sqes and moves sq_tail; a poller thread turns them
+ * into jobs, and consumers post the results as cqes */
+struct xring {
+	struct kref ref;		/* the fd and every job */
+	struct xjob_rings *rings;	/* mapped by the client */
+	struct xjob_sqe *sqes;
+	struct xjob_cqe *cqes;
+	unsigned int sq_entries;
+	unsigned int cq_entries;
+	unsigned long map_size;
+	unsigned long sq_idle;		/* in jiffies */
+	pid_t pid;
+	atomic_t inflight;		/* submitted, no cqe posted yet */
+	spinlock_t cq_lock;		/* serialize consumers posting cqes */
+	wait_queue_head_t cq_wait;	/* poll() of the ring fd */
+	wait_queue_head_t sq_wait;	/* idle poller */
+	struct task_struct *poller;
+	struct xjob_sqe sqe;		/* poller's copy of the current sqe */
+	struct job *jobs[RING_SUBMIT_BATCH];
+};
+
+static const struct file_operations ring_fops;
+
+static void ring_free(struct kref *ref)
+{
+	struct xring *ring = container_of(ref, struct xring, ref);
+
+	vfree(ring->rings);
+	kfree(ring);
+}
+
+void ring_put(struct xring *ring)
+{
+	kref_put(&ring->ref, ring_free);
+}
+
+/* cqes are never dropped: a sqe is only taken if its cqe has room */
+/* cqes that can still be promised to new jobs, it only grows while
+ * the poller is not submitting */
+static unsigned int ring_cq_space(struct xring *ring)
+{
+	struct xjob_rings *rings = ring->rings;
+	unsigned int pending;
+
+	pending = rings->cq_tail - ACCESS_ONCE(rings->cq_head);
+	pending += atomic_read(&ring->inflight);
+
+	return pending < ring->cq_entries ? ring->cq_entries - pending : 0;
+}
+
+static bool ring_cq_room(struct xring *ring)
+{
+	return ring_cq_space(ring) > 0;
+}
+
+static bool ring_sq_ready(struct xring *ring)
+{
+	struct xjob_rings *rings = ring->rings;
+
+	return rings->sq_head != ACCESS_ONCE(rings->sq_tail) &&
+		ring_cq_room(ring);
+}
+
+static void ring_post(struct xring *ring, u64 user_data, struct jobres *res)
+{
+	struct xjob_rings *rings = ring->rings;
+	struct xjob_cqe *cqe;
+
+	spin_lock(&ring->cq_lock);
+	cqe = &ring->cqes[rings->cq_tail & (ring->cq_entries - 1)];
+	cqe->user_data = user_data;
+	cqe->res = *res;
+	smp_wmb(); /* fill the cqe before the client can see it */
+	rings->cq_tail++;
+	spin_unlock(&ring->cq_lock);
+
+	atomic_dec(&ring->inflight);
+	smp_mb__after_atomic_dec();
+	wake_up_interruptible(&ring->cq_wait);
+	if (waitqueue_active(&ring->sq_wait))
+		wake_up(&ring->sq_wait); /* poller may wait for cq room */
+}
+
+void ring_complete(struct job *job, int err)
+{
+	struct jobres res;
+
+	fill_jobres(job, err, &res);
+	ring_post(job->ring, job->user_data, &res);
+}
+
+static int ring_init_job(struct xring *ring, struct xjob_sqe *sqe, int id,
+			 struct job **jobp)
+{
+	struct jobdesc desc;
+	struct job *job;
+	mm_segment_t old_fs;
+	int len;
+	int err;
+
+	sqe->paths[RING_PATH_LEN - 1] = '\0';
+	len = strlen(sqe->paths);
+	if (len + 1 >= RING_PATH_LEN)
+		return -ENAMETOOLONG;
+
+	desc.id = id;
+	desc.category = sqe->category;
+	desc.algo = sqe->algo;
+	desc.oflags = sqe->oflags;
+	desc.flags = sqe->flags;
+	desc.level = sqe->level;
+	desc.priority = sqe->priority;
+	desc.infile = (__force __user const char *)sqe->paths;
+	desc.outfile = (__force __user const char *)(sqe->paths + len + 1);
+
+	job = alloc_job();
+	if (!job)
+		return -ENOMEM;
+
+	/* the paths are in kernel memory */
+	old_fs = get_fs();
+	set_fs(get_ds());
+	err = init_job(job, &desc);
+	set_fs(old_fs);
+	if (err) {
+		destroy_job(job);
+		return err;
+	}
+
+	job->pid = ring->pid;
+	job->user_data = sqe->user_data;
+	job->ring = ring;
+	kref_get(&ring->ref);
+	*jobp = job;
+
+	return 0;
+}
+
+/* move a batch of sqes into the job queues, return how many were taken */
+static int ring_submit(struct xring *ring)
+{
+	struct xjob_rings *rings = ring->rings;
+	struct jobres res;
+	struct job *job;
+	unsigned int head, n;
+	int first_id;
+	int nr_jobs = 0;
+	int queued;
+	int err;
+	int i;
+
+	head = rings->sq_head;
+	n = ACCESS_ONCE(rings->sq_tail) - head;
+	if (n == 0)
+		return 0;
+	if (n > RING_SUBMIT_BATCH)
+		n = RING_SUBMIT_BATCH;
+	smp_rmb(); /* read the sqes after the tail */
+
+	/* ids only for the sqes taken now, the id space stays dense */
+	n = min(n, ring_cq_space(ring));
+	if (n == 0)
+		return 0;
+	first_id = new_job_ids(n);
+	for (i = 0; i < n; i++) {
+		memcpy(&ring->sqe,
+		       &ring->sqes[(head + i) & (ring->sq_entries - 1)],
+		       sizeof(struct xjob_sqe));
+		atomic_inc(&ring->inflight);
+
+		err = ring_init_job(ring, &ring->sqe, first_id + i, &job);
+		if (err) {
+			memset(&res, 0, sizeof(struct jobres));
+			res.id = first_id + i;
+			res.err = err;
+			ring_post(ring, ring->sqe.user_data, &res);
+			continue;
+		}
+		ring->jobs[nr_jobs++] = job;
+	}
+
+	/* the client may reuse the sqes once sq_head moves */
+	smp_mb();
+	rings->sq_head = head + i;
+
+	/* the poller has no one to give up to, it waits for room */
+	err = produce_batch(ring->jobs, nr_jobs, 0, 0, &queued);
+	for (; queued < nr_jobs; queued++) {
+		ring_complete(ring->jobs[queued], err);
+		destroy_job(ring->jobs[queued]);
+	}
+
+	return i;
+}
+
+static int ring_sq_poller(void *data)
+{
+	struct xring *ring = data;
+	struct xjob_rings *rings = ring->rings;
+	unsigned long timeout = jiffies + ring->sq_idle;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		if (ring_submit(ring) > 0) {
+			timeout = jiffies + ring->sq_idle;
+			continue;
+		}
+		if (time_before(jiffies, timeout)) {
+			cond_resched();
+			continue;
+		}
+
+		/* idle, the client has to ACTION_RING_ENTER to wake us up */
+		prepare_to_wait(&ring->sq_wait, &wait, TASK_INTERRUPTIBLE);
+		rings->sq_flags |= RING_NEED_WAKEUP;
+		smp_mb(); /* pairs with the client's barrier after sq_tail */
+		if (!ring_sq_ready(ring) && !kthread_should_stop())
+			schedule();
+		finish_wait(&ring->sq_wait, &wait);
+		rings->sq_flags &= ~RING_NEED_WAKEUP;
+		timeout = jiffies + ring->sq_idle;
+	}
+
+	return 0;
+}
+
+static int ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct xring *ring = file->private_data;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != ring->map_size)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->rings, 0);
+}
+
+static unsigned int ring_poll(struct file *file, poll_table *wait)
+{
+	struct xring *ring = file->private_data;
+	struct xjob_rings *rings = ring->rings;
+
+	poll_wait(file, &ring->cq_wait, wait);
+	if (ACCESS_ONCE(rings->cq_head) != ACCESS_ONCE(rings->cq_tail))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+static int ring_release(struct inode *inode, struct file *file)
+{
+	struct xring *ring = file->private_data;
+
+	/* jobs still queued keep the ring until they complete */
+	kthread_stop(ring->poller);
+	ring_put(ring);
+
+	return 0;
+}
+
+static const struct file_operations ring_fops = {
+	.owner = THIS_MODULE,
+	.mmap = ring_mmap,
+	.poll = ring_poll,
+	.release = ring_release,
+	.llseek = noop_llseek,
+};
+
+/* On success the ring fd is returned and ring_params filled */
+int ring_setup(__user struct ring_params *uparams)
+{
+	struct ring_params params;
+	struct xring *ring;
+	int err;
+	int fd;
+
+	if (copy_from_user(&params, uparams, sizeof(struct ring_params)))
+		return -EFAULT;
+	if (params.sq_entries == 0 || params.sq_entries > RING_MAX_ENTRIES)
+		return -EINVAL;
+
+	params.sq_entries = roundup_pow_of_two(params.sq_entries);
+	params.cq_entries = 2 * params.sq_entries;
+	if (!params.sq_idle_ms)
+		params.sq_idle_ms = RING_IDLE_MS;
+	params.sq_off = ALIGN(sizeof(struct xjob_rings), SMP_CACHE_BYTES);
+	params.cq_off = ALIGN(params.sq_off +
+			      params.sq_entries * sizeof(struct xjob_sqe),
+			      SMP_CACHE_BYTES);
+	params.map_size = PAGE_ALIGN(params.cq_off +
+				     params.cq_entries * sizeof(struct xjob_cqe));
+
+	ring = kzalloc(sizeof(struct xring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+	ring->rings = vmalloc_user(params.map_size);
+	if (!ring->rings) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	kref_init(&ring->ref);
+	ring->sqes = (void *)ring->rings + params.sq_off;
+	ring->cqes = (void *)ring->rings + params.cq_off;
+	ring->sq_entries = params.sq_entries;
+	ring->cq_entries = params.cq_entries;
+	ring->map_size = params.map_size;
+	ring->sq_idle = msecs_to_jiffies(params.sq_idle_ms);
+	ring->pid = current->pid;
+	ring->rings->sq_entries = params.sq_entries;
+	ring->rings->cq_entries = params.cq_entries;
+	atomic_set(&ring->inflight, 0);
+	spin_lock_init(&ring->cq_lock);
+	init_waitqueue_head(&ring->cq_wait);
+	init_waitqueue_head(&ring->sq_wait);
+
+	if (copy_to_user(uparams, &params, sizeof(struct ring_params))) {
+		err = -EFAULT;
+		goto out_free;
+	}
+
+	ring->poller = kthread_create(ring_sq_poller, ring, "xjob-sqpoll/%d",
+				      ring->pid);
+	if (IS_ERR(ring->poller)) {
+		err = PTR_ERR(ring->poller);
+		goto out_free;
+	}
+
+	fd = anon_inode_getfd("[xjob_ring]", &ring_fops, ring,
+			      O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		err = fd;
+		kthread_stop(ring->poller);
+		goto out_free;
+	}
+	wake_up_process(ring->poller);
+
+	return fd;
+
+out_free:
+	vfree(ring->rings);
+	kfree(ring);
+	return err;
+}
+
+/* wake up the poller of an idle ring */
+int ring_enter(int fd)
+{
+	struct file *file;
+	struct xring *ring;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+	if (file->f_op != &ring_fops) {
+		fput(file);
+		return -EINVAL;
+	}
+
+	ring = file->private_data;
+	wake_up(&ring->sq_wait);
+	fput(file);
+
+	return 0;
+}
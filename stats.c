@@ -0,0 +1,214 @@
+#include "xjob.h"
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+
+#define STAT_BUCKETS 32 /* log2 of usecs, the last one is 18 min and up */
+
+enum stat_latency {
+	LAT_WAIT,	/* submitted to dequeued */
+	LAT_RUN,	/* dequeued to completed */
+	LAT_TOTAL,
+	LAT_LAST,
+};
+
+static const char *lat_names[] = {"wait", "run", "total"};
+
+/* per cpu, summed up when read, so updates never contend */
+struct xjob_stats {
+	u64 jobs;
+	u64 failed;
+	u64 aborted;
+	u64 bytes;
+	u64 run_ns;
+	u64 producer_blocks;	/* producers put to sleep by a full queue */
+	int qlen_max;		/* high-water mark of qlen */
+	u64 hist[LAT_LAST][STAT_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct xjob_stats, stats);
+
+/* only written by its own consumer */
+struct consumer_stats {
+	ktime_t since;		/* started */
+	u64 jobs;
+	u64 bytes;
+	u64 busy_ns;
+} ____cacheline_aligned_in_smp;
+
+static struct consumer_stats consumer_stats[CONSUMER_MAX];
+static ktime_t stats_since;	/* module load, the stats are never reset */
+
+static int stat_bucket(s64 ns)
+{
+	u64 us = ns > 0 ? div_u64(ns, NSEC_PER_USEC) : 0;
+
+	return min(fls64(us), STAT_BUCKETS - 1);
+}
+
+/* job is done, it was dequeued at job->start_time */
+void stat_job(struct job *job, int cid)
+{
+	ktime_t now = ktime_get();
+	s64 wait = ktime_to_ns(ktime_sub(job->start_time, job->submit_time));
+	s64 run = ktime_to_ns(ktime_sub(now, job->start_time));
+	struct consumer_stats *c = &consumer_stats[cid];
+	struct xjob_stats *s;
+
+	s = &get_cpu_var(stats);
+	s->jobs++;
+	if (job->state == STATE_FAILED)
+		s->failed++;
+	else if (job->state == STATE_ABORTE)
+		s->aborted++;
+	s->bytes += job->bytes;
+	s->run_ns += run;
+	s->hist[LAT_WAIT][stat_bucket(wait)]++;
+	s->hist[LAT_RUN][stat_bucket(run)]++;
+	s->hist[LAT_TOTAL][stat_bucket(wait + run)]++;
+	put_cpu_var(stats);
+
+	c->jobs++;
+	c->bytes += job->bytes;
+	c->busy_ns += run;
+}
+
+/* consumer cid was busy since start, on anything but a job */
+void stat_busy(int cid, ktime_t start)
+{
+	consumer_stats[cid].busy_ns +=
+		ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+void stat_consumer_start(int cid)
+{
+	struct consumer_stats *c = &consumer_stats[cid];
+
+	c->jobs = 0;
+	c->bytes = 0;
+	c->busy_ns = 0;
+	c->since = ktime_get();
+}
+
+void stat_qlen(int len)
+{
+	struct xjob_stats *s = &get_cpu_var(stats);
+
+	if (len > s->qlen_max)
+		s->qlen_max = len;
+	put_cpu_var(stats);
+}
+
+void stat_producer_block(void)
+{
+	struct xjob_stats *s = &get_cpu_var(stats);
+
+	s->producer_blocks++;
+	put_cpu_var(stats);
+}
+
+/* upper bound in usecs of the bucket holding the permille-th sample */
+static u64 stat_percentile(u64 *hist, u64 total, int permille)
+{
+	u64 rank = div_u64(total * permille + 999, 1000);
+	u64 sum = 0;
+	int b;
+
+	for (b = 0; b < STAT_BUCKETS - 1; b++) {
+		sum += hist[b];
+		if (sum >= rank)
+			break;
+	}
+
+	return 1ULL << b;
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	struct xjob_stats *s;
+	struct xjob_stats sum;
+	struct consumer_stats *c;
+	u64 hist[STAT_BUCKETS];
+	s64 up = ktime_to_ns(ktime_sub(ktime_get(), stats_since));
+	int cpu;
+	int i, b;
+
+	memset(&sum, 0, offsetof(struct xjob_stats, hist));
+	for_each_possible_cpu(cpu) {
+		s = &per_cpu(stats, cpu);
+		sum.jobs += s->jobs;
+		sum.failed += s->failed;
+		sum.aborted += s->aborted;
+		sum.bytes += s->bytes;
+		sum.run_ns += s->run_ns;
+		sum.producer_blocks += s->producer_blocks;
+		sum.qlen_max = max(sum.qlen_max, s->qlen_max);
+	}
+
+	seq_printf(m, "jobs: %llu\n", sum.jobs);
+	seq_printf(m, "failed: %llu\n", sum.failed);
+	seq_printf(m, "aborted: %llu\n", sum.aborted);
+	seq_printf(m, "bytes: %llu\n", sum.bytes);
+	seq_printf(m, "throughput: %llu MB/s\n", up > 0 ?
+		   div64_u64(sum.bytes * 1000, up) : 0);
+	/* while a consumer runs a job */
+	seq_printf(m, "per-consumer throughput: %llu MB/s\n", sum.run_ns ?
+		   div64_u64(sum.bytes * 1000, sum.run_ns) : 0);
+	seq_printf(m, "producer blocks: %llu\n", sum.producer_blocks);
+	seq_printf(m, "queue high-water: %d/%d\n", sum.qlen_max, qmax);
+
+	seq_printf(m, "\nlatency(us)\tp50\tp99\tp999\n");
+	for (i = 0; i < LAT_LAST; i++) {
+		memset(hist, 0, sizeof(hist));
+		for_each_possible_cpu(cpu) {
+			s = &per_cpu(stats, cpu);
+			for (b = 0; b < STAT_BUCKETS; b++)
+				hist[b] += s->hist[i][b];
+		}
+		seq_printf(m, "%s\t\t<%llu\t<%llu\t<%llu\n", lat_names[i],
+			   stat_percentile(hist, sum.jobs, 500),
+			   stat_percentile(hist, sum.jobs, 990),
+			   stat_percentile(hist, sum.jobs, 999));
+	}
+
+	seq_printf(m, "\nconsumer\tjobs\tbytes\tbusy\n");
+	for (i = 0; i < num_consumer; i++) {
+		c = &consumer_stats[i];
+		up = ktime_to_ns(ktime_sub(ktime_get(), c->since));
+		seq_printf(m, "%d\t\t%llu\t%llu\t%llu%%\n", i, c->jobs,
+			   c->bytes, up > 0 ?
+			   div64_u64(c->busy_ns * 100, up) : 0);
+	}
+
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int init_stats(void)
+{
+	stats_since = ktime_get();
+
+	/* /proc/xjob/stats */
+	if (!proc_create("stats", 0444, proc_xjob, &stats_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+void destroy_stats(void)
+{
+	remove_proc_entry("stats", proc_xjob);
+}
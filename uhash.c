@@ -0,0 +1,257 @@
+#include <string.h>
+#include <sys/types.h>
+
+#define __user
+#define NAME_MAX 255
+
+#include "common.h"
+#include "uhash.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void md5_block(uint32_t *s, const unsigned char *p)
+{
+	static const uint32_t k[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+		0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+		0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+		0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+		0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+		0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+		0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+		0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+		0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+	};
+	static const int r[16] = {
+		7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21,
+	};
+	uint32_t w[16];
+	uint32_t a = s[0], b = s[1], c = s[2], d = s[3];
+	uint32_t f, t;
+	int i, g;
+
+	for (i = 0; i < 16; i++)
+		w[i] = get_le32(p + 4 * i);
+
+	for (i = 0; i < 64; i++) {
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+		t = d;
+		d = c;
+		c = b;
+		b += ROL(a + f + k[i] + w[g], r[(i / 16) * 4 + i % 4]);
+		a = t;
+	}
+
+	s[0] += a;
+	s[1] += b;
+	s[2] += c;
+	s[3] += d;
+}
+
+static void sha1_block(uint32_t *s, const unsigned char *p)
+{
+	uint32_t w[80];
+	uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+	uint32_t f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = get_be32(p + 4 * i);
+	for (; i < 80; i++)
+		w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+
+	s[0] += a;
+	s[1] += b;
+	s[2] += c;
+	s[3] += d;
+	s[4] += e;
+}
+
+static void sha256_block(uint32_t *s, const unsigned char *p)
+{
+	static const uint32_t k[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+		0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+		0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+		0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+		0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+		0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+		0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+		0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+		0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+	uint32_t w[64];
+	uint32_t v[8];
+	uint32_t t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = get_be32(p + 4 * i);
+	for (; i < 64; i++)
+		w[i] = w[i - 16] + w[i - 7] +
+			(ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^
+			 (w[i - 15] >> 3)) +
+			(ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^
+			 (w[i - 2] >> 10));
+
+	memcpy(v, s, sizeof(v));
+	for (i = 0; i < 64; i++) {
+		t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25)) +
+			((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+		t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22)) +
+			((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(v + 1, v, 7 * sizeof(uint32_t));
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		s[i] += v[i];
+}
+
+static void hash_block(struct uhash_ctx *ctx, const unsigned char *p)
+{
+	if (ctx->algo == ALGORITHM_MD5)
+		md5_block(ctx->state, p);
+	else if (ctx->algo == ALGORITHM_SHA1)
+		sha1_block(ctx->state, p);
+	else
+		sha256_block(ctx->state, p);
+}
+
+int uhash_init(struct uhash_ctx *ctx, int algo)
+{
+	static const uint32_t md5_iv[] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+	};
+	static const uint32_t sha1_iv[] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+	};
+	static const uint32_t sha256_iv[] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memset(ctx, 0, sizeof(struct uhash_ctx));
+	ctx->algo = algo;
+	if (algo == ALGORITHM_MD5)
+		memcpy(ctx->state, md5_iv, sizeof(md5_iv));
+	else if (algo == ALGORITHM_SHA1)
+		memcpy(ctx->state, sha1_iv, sizeof(sha1_iv));
+	else if (algo == ALGORITHM_SHA256)
+		memcpy(ctx->state, sha256_iv, sizeof(sha256_iv));
+	else
+		return -1;
+
+	return 0;
+}
+
+void uhash_update(struct uhash_ctx *ctx, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t used = ctx->len % 64;
+	size_t n;
+
+	ctx->len += len;
+	while (len > 0) {
+		n = 64 - used < len ? 64 - used : len;
+		memcpy(ctx->block + used, p, n);
+		used += n;
+		p += n;
+		len -= n;
+		if (used == 64) {
+			hash_block(ctx, ctx->block);
+			used = 0;
+		}
+	}
+}
+
+void uhash_final(struct uhash_ctx *ctx, unsigned char *out)
+{
+	uint64_t bits = ctx->len * 8;
+	size_t used = ctx->len % 64;
+	int i;
+
+	ctx->block[used++] = 0x80;
+	if (used > 56) {
+		memset(ctx->block + used, 0, 64 - used);
+		hash_block(ctx, ctx->block);
+		used = 0;
+	}
+	memset(ctx->block + used, 0, 56 - used);
+
+	/* md5 is little endian, sha big endian */
+	for (i = 0; i < 8; i++) {
+		if (ctx->algo == ALGORITHM_MD5)
+			ctx->block[56 + i] = bits >> (8 * i);
+		else
+			ctx->block[63 - i] = bits >> (8 * i);
+	}
+	hash_block(ctx, ctx->block);
+
+	for (i = 0; i < get_hash_size(ctx->algo); i++) {
+		if (ctx->algo == ALGORITHM_MD5)
+			out[i] = ctx->state[i / 4] >> (8 * (i % 4));
+		else
+			out[i] = ctx->state[i / 4] >> (8 * (3 - i % 4));
+	}
+}
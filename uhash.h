@@ -0,0 +1,19 @@
+#ifndef _UHASH_H_
+#define _UHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* userspace md5/sha1/sha256, to verify the module's digests */
+struct uhash_ctx {
+	int algo;
+	uint32_t state[8];
+	uint64_t len;		/* bytes hashed */
+	unsigned char block[64];
+};
+
+int uhash_init(struct uhash_ctx *ctx, int algo);
+void uhash_update(struct uhash_ctx *ctx, const void *data, size_t len);
+void uhash_final(struct uhash_ctx *ctx, unsigned char *out);
+
+#endif	/* not _UHASH_H_ */
@@ -1,61 +1,35 @@
 #include "xjob.h"
+#include "xjob_trace.h"
 
-static int __produce(struct job *job, wait_queue_t *wait)
-{
-	struct queue *q;
-	int err = 0;
-
-	mutex_lock(&qmutex);
+/* jobs being processed, so that removal can cancel them */
+static LIST_HEAD(running_jobs);
+static DEFINE_SPINLOCK(running_lock);
 
-	if (qlen >= qmax) {
-		prepare_to_wait_exclusive(&pwq, wait, TASK_UNINTERRUPTIBLE);
-		err = -EAGAIN;
-		goto out;
-	}
-
-	q = kmalloc(sizeof(struct queue), GFP_KERNEL);
-	if (q == NULL) {
-		err = -ENOMEM;
-		goto out;
-	}
-	q->job = job;
-	INFO("add new job[%u] to task queue", job->id);
-	add2queue(q);
-	qlen++;
-
-	wake_up(&cwq); /* wake up one consumer */
-out:
-	mutex_unlock(&qmutex);
-	return err;
-}
-
-int produce(struct job *job)
+void fill_jobres(struct job *job, int err, struct jobres *res)
 {
-	int err = 0;
-	DEFINE_WAIT(wait);
-	while (1) {
-		err = __produce(job, &wait);
-		if (err != -EAGAIN)
-			break;
-		/* entered the wait queue */
-		INFO("Producer: waiting");
-		schedule();
-		INFO("Producer: awaking");
-		/* during rmmod, we should stop producing or sleeping */
-		if (should_stop) {
-			err = -EBUSY;
-			break;
-		}
-	}
-
-	return err;
+	res->id = job->id;
+	res->err = err;
+	res->bytes = job->bytes;
+	res->nsecs = ktime_to_ns(ktime_sub(ktime_get(), job->submit_time));
+	res->hash_len = err ? 0 : job->hash_len;
+	memcpy(res->hash, job->hash, res->hash_len);
 }
 
-static void notify_user(struct job *job, int err, int cid)
+void notify_user(struct job *job, int err, int cid)
 {
 	struct siginfo sinfo;
 	struct task_struct *task;
 
+	trace_xjob_notify(job, err);
+	if (job->ring) {
+		ring_complete(job, err);
+		return;
+	}
+	if (job->cq || job->efd) {
+		cq_complete(job, err);
+		return;
+	}
+
 	memset(&sinfo, 0, sizeof(struct siginfo));
 	sinfo.si_code = SI_QUEUE; /* important, make si_int available */
 	sinfo.si_int = job->id;
@@ -63,7 +37,7 @@ static void notify_user(struct job *job, int err, int cid)
 	sinfo.si_uid = current_uid();
 	if (job->state == STATE_SUCCESS)
 		sinfo.si_errno = 0;
-	else if (job->state == STATE_FAILED)
+	else if (job->state == STATE_FAILED || job->state == STATE_ABORTE)
 		sinfo.si_errno = -err; /* make it positive */
 	else
 		return;
@@ -80,128 +54,101 @@ static void notify_user(struct job *job, int err, int cid)
 static int __process_job(struct job *job)
 {
 	if (job->category == CATEGORY_CHECKSUM)
-		return checksum(job->algo, job->infile, job->outfile,
-				job->oflags);
+		return checksum(job);
+	if (job->category == CATEGORY_COMPRESS)
+		return compress(job);
 
 	return -ENOTSUPP;
 }
 
-static int process_job(struct job *job, int cid)
+static void start_job(struct job *job)
 {
-	int err = 0;
 	job->state = STATE_PROCESSING;
-
-	INFO("%s", job->infile);
-
-	err = __process_job(job);
-	if (err)
-		INFO("__process_job return %d", err);
-	job->state = err ? STATE_FAILED : STATE_SUCCESS;
-
-	notify_user(job, err, cid);
-	destroy_job(job);
-
-	return 0;
+	job->start_time = ktime_get();
+	trace_xjob_process_start(job, 0);
+	spin_lock(&running_lock);
+	list_add_tail(&job->list, &running_jobs);
+	spin_unlock(&running_lock);
 }
 
-static int __consume(wait_queue_t *wait, int cid)
+static void end_job(struct job *job, int err, int cid)
 {
-	struct queue *q;
-	int ret;
-
-	mutex_lock(&qmutex);
-
-	if (qlen == 0) {
-		INFO("Consumer/%d: waiting", cid);
-		prepare_to_wait_exclusive(&cwq, wait, TASK_INTERRUPTIBLE);
-		mutex_unlock(&qmutex);
-		return 0;
-	}
-	q = remove_first_job();
-	qlen--;
-
-	if (qlen < qmax && waitqueue_active(&pwq))
-		wake_up(&pwq); /* wake up one producer */
-
-	mutex_unlock(&qmutex);
-
-	INFO("Consumer/%d: processing job[%u]", cid, q->job->id);
-	ret = process_job(q->job, cid);
-	INFO("Consumer/%d: done", cid);
-	kfree(q);
-
-	return ret;
+	spin_lock(&running_lock);
+	list_del(&job->list);
+	spin_unlock(&running_lock);
+
+	job->err = err;
+	if (!err)
+		job->state = STATE_SUCCESS;
+	else if (err == -ECANCELED && job->cancel)
+		job->state = STATE_ABORTE;
+	else
+		job->state = STATE_FAILED;
+	trace_xjob_process_end(job, err);
+	stat_job(job, cid);
 }
 
-int consume(void *cid)
+/* ask every running job to stop at its next chunk. a job then
+ * completes with -ECANCELED */
+void cancel_running(void)
 {
-	DEFINE_WAIT(wait);
-	INFO("Consumer/%d: Initialized!", (int)cid);
-	while (1) {
-		__consume(&wait, (int)cid);
-		schedule();
-		/* if wake up by kthread_stop, do not fall asleep again
-		 * absence of "should_stop" will cause problem during rmmod */
-		if (should_stop || kthread_should_stop())
-			break;
-	}
+	struct job *job;
 
-	return 0;
+	spin_lock(&running_lock);
+	list_for_each_entry(job, &running_jobs, list)
+		job->cancel = CANCEL_ALL;
+	spin_unlock(&running_lock);
 }
 
-/* to invoke the queue functions below, grab qmutex first */
-void add2queue(struct queue *q)
+/* a job coalesced with leader, which is done */
+static void process_follower(struct job *job, struct job *leader, int cid)
 {
-	q->next = NULL;
-
-	if (!tail) {
-		tail = q;
-		head = q;
-		return;
-	}
+	int err;
 
-	tail->next = q;
-	tail = q;
-}
+	start_job(job);
 
-struct queue *remove_first_job(void)
-{
-	struct queue *ret = head;
-	head = head->next;
-	if (!head)
-		tail = NULL;
+	/* removed once off the followers list, too late to detach */
+	if (ACCESS_ONCE(job->cancel))
+		err = -ECANCELED;
+	/* the leader may have failed on its own outfile, before hashing */
+	else if (leader->hash_len)
+		err = checksum_follow(job, leader);
+	else
+		err = __process_job(job);
+	end_job(job, err, cid);
 
-	return ret;
+	notify_user(job, err, cid);
+	destroy_job(job);
 }
 
-/* only remove its first occurrence */
-struct queue *remove_job(int id)
+int process_job(struct job *job, int cid)
 {
-	struct queue *prev = NULL;
-	struct queue *curr = head;
-
-	if (!curr)
-		return NULL;
+	struct job *f, *tmp;
+	LIST_HEAD(followers);
+	int err = 0;
+	start_job(job);
 
-	while (curr->job->id != id) {
-		prev = curr;
-		curr = curr->next;
-		if (!curr)
-			break;
-	}
+	/* removed before it was queued, or just dequeued */
+	if (ACCESS_ONCE(job->cancel))
+		err = -ECANCELED;
+	else
+		err = __process_job(job);
+	end_job(job, err, cid);
 
-	/* found */
-	if (curr) {
-		if (prev) /* curr is not head */
-			prev->next = curr->next;
+	/* no job can join it from now on */
+	flight_end(job, &followers);
+	notify_user(job, err, cid);
+	list_for_each_entry_safe(f, tmp, &followers, list) {
+		list_del(&f->list);
+		/* canceled on its own, the others still want the digest */
+		if (job->cancel == CANCEL_ALL)
+			discard_job(f);
 		else
-			head = curr->next;
-
-		if (curr == tail)
-			tail = prev;
+			process_follower(f, job, cid);
 	}
+	destroy_job(job);
 
-	return curr;
+	return 0;
 }
 
 /*
@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define __user
+#define NAME_MAX 255
+
+#include "common.h"
+
+#define __NR_xjob	349	/* our private syscall number */
+#define MAX_SPECS	64
+#define CQ_BATCH	64	/* completion records per read */
+
+/* load generator: threads submit jobs picked from the specs, each thread
+ * collects its completions on its own cq fd */
+
+/* "infile[:algo[:weight]]" */
+struct spec {
+	char *infile;
+	unsigned int category;
+	unsigned int algo;
+	int weight;
+};
+
+struct worker {
+	pthread_t thread;
+	int tid;
+	int cq_fd;
+	unsigned int seed;
+	int submitted;
+	int completed;
+	int failed;
+	int rejected;		/* -EAGAIN, queue full in open loop */
+	unsigned long long bytes;
+	unsigned long long *nsecs; /* latency of each completed job */
+};
+
+struct spec specs[MAX_SPECS];
+int nr_specs;
+int total_weight;
+int nr_threads = 4;
+int jobs_per_thread = 100;
+int depth = 1;		/* closed loop: jobs in flight per thread */
+double rate;		/* open loop: jobs/s over all threads, 0 for closed */
+int priority = PRIORITY_DEFAULT;
+char *outdir;		/* NULL for /dev/null */
+int no_outfile;		/* checksums return their digest in the jobres */
+char *format = "csv";
+
+void usage()
+{
+	printf("usage: xbench [flags] infile[:algo[:weight]]...\n");
+	printf("\n");
+	printf(" every job picks an infile by weight(1 by default), algo is\n"
+	       " md5(default), sha1, sha256, deflate or lzo\n");
+	printf("\n");
+	printf(" flags:\n");
+	printf(" -t N: submitting threads(%d)\n", nr_threads);
+	printf(" -n N: jobs per thread(%d)\n", jobs_per_thread);
+	printf(" -q N: closed loop, jobs in flight per thread(%d)\n", depth);
+	printf(" -r RATE: open loop, submit RATE jobs/s over all threads\n"
+	       "     whatever the completions, a full queue rejects jobs\n");
+	printf(" -p PRIO: priority class(low, normal, high)\n");
+	printf(" -O DIR: write outfiles to DIR instead of /dev/null\n");
+	printf(" -N: checksums without outfile\n");
+	printf(" -f FMT: report as csv(default) or json\n");
+	printf(" -h: print this usage\n");
+}
+
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int parse_spec(char *arg, struct spec *spec)
+{
+	char *name = strtok(arg, ":");
+	char *algo = strtok(NULL, ":");
+	char *weight = strtok(NULL, ":");
+	int i;
+
+	spec->infile = realpath(name, NULL);
+	if (!spec->infile) {
+		printf("%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	spec->algo = ALGORITHM_MD5;
+	if (algo) {
+		spec->algo = ALGORITHM_UNDEFINED;
+		for (i = ALGORITHM_MD5; i < ALGORITHM_LAST; i++) {
+			if (strcmp(algo, get_algo_name(i)) == 0)
+				spec->algo = i;
+		}
+		if (spec->algo == ALGORITHM_UNDEFINED) {
+			printf("%s: unknown algorithm\n", algo);
+			return -1;
+		}
+	}
+	spec->category = get_hash_size(spec->algo) ? CATEGORY_CHECKSUM :
+		CATEGORY_COMPRESS;
+
+	spec->weight = weight ? strtol(weight, 0, 10) : 1;
+	if (spec->weight <= 0) {
+		printf("%s: invalid weight\n", weight);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct spec *pick_spec(struct worker *w)
+{
+	int r = rand_r(&w->seed) % total_weight;
+	int i;
+
+	for (i = 0; r >= specs[i].weight; i++)
+		r -= specs[i].weight;
+
+	return &specs[i];
+}
+
+/* submit one job, return 0, or -1 if it was rejected */
+int submit(struct worker *w)
+{
+	struct spec *spec = pick_spec(w);
+	struct jobdesc desc;
+	struct xargs args;
+	char outfile[4096];
+	int rc;
+
+	if (outdir)
+		snprintf(outfile, sizeof(outfile), "%s/xbench.%d.%d.%s",
+			 outdir, w->tid, w->submitted,
+			 get_algo_name(spec->algo));
+	else
+		strcpy(outfile, "/dev/null");
+
+	memset(&desc, 0, sizeof(desc));
+	desc.category = spec->category;
+	desc.algo = spec->algo;
+	desc.priority = priority;
+	desc.infile = spec->infile;
+	desc.outfile = outfile;
+	if (no_outfile && spec->category == CATEGORY_CHECKSUM) {
+		desc.flags = XJOB_F_NO_OUTFILE;
+		desc.outfile = NULL;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.action = ACTION_SUBMIT_BATCH;
+	args.batch_buf = &desc;
+	args.batch_len = 1;
+	args.flags = XJOB_F_CQ;
+	if (rate > 0)
+		args.flags |= XJOB_F_NONBLOCK;
+	args.cq_fd = w->cq_fd;
+
+	w->submitted++;
+	rc = syscall(__NR_xjob, (void *)&args, sizeof(struct xargs));
+	if (rc == 1)
+		return 0;
+	if (rc < 0)
+		perror("submit error");
+	else if (desc.err != -EAGAIN)
+		printf("submit error: %s\n", strerror(-desc.err));
+	w->rejected++;
+
+	return -1;
+}
+
+/* read the completions there are, or wait for one if block,
+ * return how many were read */
+int reap(struct worker *w, int block)
+{
+	struct jobres res[CQ_BATCH];
+	struct pollfd pfd;
+	ssize_t len;
+	int i, n;
+
+	if (!block) {
+		pfd.fd = w->cq_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) <= 0)
+			return 0;
+	}
+
+	do {
+		len = read(w->cq_fd, res, sizeof(res));
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) {
+		perror("completion read error");
+		exit(1);
+	}
+
+	n = len / sizeof(struct jobres);
+	for (i = 0; i < n; i++) {
+		w->nsecs[w->completed++] = res[i].nsecs;
+		w->bytes += res[i].bytes;
+		if (res[i].err)
+			w->failed++;
+	}
+
+	return n;
+}
+
+void sleep_until(double t)
+{
+	struct timespec ts;
+	double d = t - now();
+
+	if (d <= 0)
+		return;
+	ts.tv_sec = d;
+	ts.tv_nsec = (d - ts.tv_sec) * 1e9;
+	nanosleep(&ts, NULL);
+}
+
+void *run(void *arg)
+{
+	struct worker *w = arg;
+	double interval = rate > 0 ? nr_threads / rate : 0;
+	/* threads out of phase, so the rate is even, not bursts */
+	double start = now() + w->tid * interval / nr_threads;
+	int inflight = 0;
+	int i;
+
+	for (i = 0; i < jobs_per_thread; i++) {
+		if (interval > 0) {
+			/* on schedule, even if we fell behind */
+			sleep_until(start + i * interval);
+		} else {
+			while (inflight >= depth)
+				inflight -= reap(w, 1);
+		}
+		if (submit(w) == 0)
+			inflight++;
+		inflight -= reap(w, 0);
+	}
+	while (inflight > 0)
+		inflight -= reap(w, 1);
+
+	return NULL;
+}
+
+int cmp_nsecs(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+double percentile(unsigned long long *nsecs, int n, double p)
+{
+	int i;
+
+	if (!n)
+		return 0;
+	i = p * n;
+	if (i >= n)
+		i = n - 1;
+
+	return nsecs[i] / 1e6;
+}
+
+void report(struct worker *workers, double secs)
+{
+	unsigned long long *nsecs;
+	unsigned long long bytes = 0;
+	double sum = 0;
+	int submitted = 0, completed = 0, failed = 0, rejected = 0;
+	int i, j;
+
+	for (i = 0; i < nr_threads; i++) {
+		submitted += workers[i].submitted;
+		completed += workers[i].completed;
+		failed += workers[i].failed;
+		rejected += workers[i].rejected;
+		bytes += workers[i].bytes;
+	}
+
+	nsecs = malloc((completed + 1) * sizeof(*nsecs));
+	if (!nsecs) {
+		printf("malloc failed\n");
+		return;
+	}
+	for (i = 0, completed = 0; i < nr_threads; i++) {
+		for (j = 0; j < workers[i].completed; j++) {
+			nsecs[completed++] = workers[i].nsecs[j];
+			sum += workers[i].nsecs[j];
+		}
+	}
+	qsort(nsecs, completed, sizeof(*nsecs), cmp_nsecs);
+
+	if (strcmp(format, "json") == 0) {
+		printf("{\"threads\": %d, \"rate\": %.1f, \"submitted\": %d, "
+		       "\"completed\": %d, \"failed\": %d, \"rejected\": %d, "
+		       "\"secs\": %.3f, \"jobs_per_sec\": %.1f, "
+		       "\"mb_per_sec\": %.1f, \"mean_ms\": %.3f, "
+		       "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, "
+		       "\"p999_ms\": %.3f, \"max_ms\": %.3f}\n",
+		       nr_threads, rate, submitted, completed, failed,
+		       rejected, secs, completed / secs, bytes / secs / 1e6,
+		       completed ? sum / completed / 1e6 : 0,
+		       percentile(nsecs, completed, 0.5),
+		       percentile(nsecs, completed, 0.9),
+		       percentile(nsecs, completed, 0.99),
+		       percentile(nsecs, completed, 0.999),
+		       percentile(nsecs, completed, 1));
+	} else {
+		printf("threads,rate,submitted,completed,failed,rejected,secs,"
+		       "jobs_per_sec,mb_per_sec,mean_ms,p50_ms,p90_ms,p99_ms,"
+		       "p999_ms,max_ms\n");
+		printf("%d,%.1f,%d,%d,%d,%d,%.3f,%.1f,%.1f,%.3f,%.3f,%.3f,"
+		       "%.3f,%.3f,%.3f\n",
+		       nr_threads, rate, submitted, completed, failed,
+		       rejected, secs, completed / secs, bytes / secs / 1e6,
+		       completed ? sum / completed / 1e6 : 0,
+		       percentile(nsecs, completed, 0.5),
+		       percentile(nsecs, completed, 0.9),
+		       percentile(nsecs, completed, 0.99),
+		       percentile(nsecs, completed, 0.999),
+		       percentile(nsecs, completed, 1));
+	}
+
+	free(nsecs);
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker *workers;
+	struct xargs args;
+	double start;
+	int err = 0;
+	int ch;
+	int i;
+
+	while ((ch = getopt(argc, argv, "NO:f:hn:p:q:r:t:")) != -1) {
+		switch (ch) {
+		case 't':
+			nr_threads = strtol(optarg, 0, 10);
+			break;
+		case 'n':
+			jobs_per_thread = strtol(optarg, 0, 10);
+			break;
+		case 'q':
+			depth = strtol(optarg, 0, 10);
+			break;
+		case 'r':
+			rate = strtod(optarg, NULL);
+			break;
+		case 'p':
+			for (priority = PRIORITY_LOW; priority < PRIORITY_LAST;
+			     priority++) {
+				if (!strcmp(optarg, get_priority_name(priority)))
+					break;
+			}
+			if (priority == PRIORITY_LAST) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'O':
+			outdir = optarg;
+			break;
+		case 'N':
+			no_outfile = 1;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'h':
+		case '?':
+		default:
+			usage();
+			exit(1);
+			break;
+		}
+	}
+
+	if (optind >= argc || argc - optind > MAX_SPECS || nr_threads <= 0 ||
+	    jobs_per_thread <= 0 || depth <= 0 || rate < 0 ||
+	    (strcmp(format, "csv") && strcmp(format, "json"))) {
+		usage();
+		exit(1);
+	}
+	for (i = optind; i < argc; i++) {
+		if (parse_spec(argv[i], &specs[nr_specs]))
+			exit(1);
+		total_weight += specs[nr_specs++].weight;
+	}
+
+	workers = calloc(nr_threads, sizeof(struct worker));
+	if (!workers) {
+		printf("malloc failed\n");
+		exit(1);
+	}
+	memset(&args, 0, sizeof(args));
+	args.action = ACTION_CQ_SETUP;
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].tid = i;
+		workers[i].seed = i + 1;
+		workers[i].nsecs = malloc(jobs_per_thread *
+					  sizeof(unsigned long long));
+		workers[i].cq_fd = syscall(__NR_xjob, (void *)&args,
+					   sizeof(struct xargs));
+		if (!workers[i].nsecs || workers[i].cq_fd < 0) {
+			perror("completion fd setup error");
+			exit(1);
+		}
+	}
+
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, run,
+				   &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	report(workers, now() - start);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (workers[i].failed)
+			err = 1;
+		close(workers[i].cq_fd);
+		free(workers[i].nsecs);
+	}
+	free(workers);
+
+	return err;
+}
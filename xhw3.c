@@ -6,14 +6,20 @@
 #include <errno.h>
 #include <ctype.h>
 #include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
 
 #define __user
 #define NAME_MAX 255
 
 #include "common.h"
+#include "uhash.h"
 
 #define __NR_xjob	349	/* our private syscall number */
-#define JOB_LIST_LEN	20
+#define JOB_LIST_LEN	256
+#define RING_ENTRIES	256
+#define VERIFY_BUF	65536
 #define O_EXCL		00000200
 
 int job_id = -1;
@@ -36,12 +42,36 @@ void usage()
 	printf(" flags:\n");
 	printf(" -o: output file\n");
 	printf(" -w: overwrite existing output file\n");
-	printf(" -a ALGO: set checksum algorithm(md5, sha1)\n");
+	printf(" -a ALGO: set checksum algorithm(md5, sha1, sha256), or\n"
+	       "     compression algorithm(deflate, lzo). a checksum list\n"
+	       "     like md5,sha1 reads infile once for every digest\n");
 	printf(" -C: calculate the checksum of infile\n");
-	printf(" -R: remove all queued jobs\n");
-	printf(" -r: remove queued job by id\n");
-	printf(" -L: list all(%d) queued jobs\n", JOB_LIST_LEN);
+	printf(" -Z: compress infile, deflate by default\n");
+	printf(" -D: with -Z, decompress infile instead\n");
+	printf(" -l LEVEL: compression level(1-9)\n");
+	printf(" -p PRIO: priority class(low, normal, high)\n");
+	printf(" -R: remove all queued jobs, cancel the running ones\n");
+	printf(" -r: remove or cancel job by id\n");
+	printf(" -S: status of job by id, queued, running or recent\n");
+	printf(" -L: list the queued jobs, %d per syscall, of a category\n"
+	       "     with -C or -Z\n", JOB_LIST_LEN);
+	printf(" -P PID: with -L, only the jobs of PID\n");
+	printf(" -A: with -L, jobs in any state, not only queued ones\n");
+	printf(" -B: submit 'infile [outfile]' lines from stdin in batches,\n"
+	       "     outfile defaults to infile.ALGO, a full queue blocks\n"
+	       "     as with -t\n");
+	printf(" -U: like -B, but through shared rings, waits for results\n");
+	printf(" -F: wait for results on a completion fd instead of SIGUSR1,\n"
+	       "     with -B waits for the whole batch\n");
+	printf(" -N: checksum without outfile, print the digest returned\n"
+	       "     by the kernel instead\n");
+	printf(" -T: tree digest, leaves hashed in parallel by all consumers\n");
+	printf(" -V: compute the digest of infile here, with -o compare it\n"
+	       "     to that digest file, with -T as a tree digest\n");
 	printf(" -n: do not block after creating job\n");
+	printf(" -t MS: when the queue is full, wait at most MS for room,\n"
+	       "     0 to fail at once\n");
+	printf(" -i: any signal ends the wait for queue room\n");
 	printf(" -h: print this usage\n");
 }
 
@@ -68,6 +98,469 @@ char *get_outfile_path(char *outfile)
 	return path;
 }
 
+/* "md5", or a list like "md5,sha1,sha256" which gives a mask of
+ * ALGO_BIT()s for XJOB_F_ALGO_MASK */
+int parse_algos(char *list, int *mask)
+{
+	unsigned int bits = 0;
+	char *name;
+	int algo = ALGORITHM_UNDEFINED;
+	int nr = 0;
+	int i;
+
+	for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+		algo = ALGORITHM_UNDEFINED;
+		for (i = ALGORITHM_MD5; i < ALGORITHM_LAST; i++) {
+			if (strcmp(name, get_algo_name(i)) == 0)
+				algo = i;
+		}
+		if (algo == ALGORITHM_UNDEFINED)
+			return ALGORITHM_UNDEFINED;
+		bits |= ALGO_BIT(algo);
+		nr++;
+	}
+
+	*mask = nr > 1;
+	if (nr <= 1)
+		return algo;
+	if (bits & ~ALGO_HASH_MASK)
+		return ALGORITHM_UNDEFINED;
+
+	return bits;
+}
+
+const char *outfile_suffix(struct xargs *args)
+{
+	if (args->flags & XJOB_F_ALGO_MASK)
+		return "digests";
+
+	return get_algo_name(args->algo);
+}
+
+/* parse one "infile [outfile]" line of stdin, outfile defaults to
+ * infile.suffix. return 1 on a job, 0 on a bad line and -1 on EOF */
+int read_job_line(const char *suffix, char **infile, char **outfile)
+{
+	static char *line;
+	static size_t cap;
+	char *in, *out;
+
+	do {
+		if (getline(&line, &cap, stdin) < 0) {
+			free(line);
+			line = NULL;
+			return -1;
+		}
+		in = strtok(line, " \t\n");
+	} while (!in);
+	out = strtok(NULL, " \t\n");
+
+	*infile = realpath(in, NULL);
+	if (!*infile) {
+		printf("%s: %s\n", in, strerror(errno));
+		return 0;
+	}
+	if (out) {
+		*outfile = get_outfile_path(out);
+	} else if (asprintf(outfile, "%s.%s", *infile, suffix) < 0) {
+		*outfile = NULL;
+	}
+	if (!*outfile) {
+		printf("%s: invalid output file path\n", in);
+		free(*infile);
+		return 0;
+	}
+
+	return 1;
+}
+
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void print_rate(int jobs, int failed, double start)
+{
+	double secs = now() - start;
+
+	printf("Total: %d jobs, %d failed, %.3f s, %.0f jobs/s\n",
+	       jobs, failed, secs, secs > 0 ? jobs / secs : 0);
+}
+
+/* the raw digests of a jobres or jobstatus, as hex */
+void print_hash(const unsigned char *hash, unsigned int len)
+{
+	unsigned int i;
+
+	if (!len)
+		return;
+	printf(", ");
+	for (i = 0; i < len; i++)
+		printf("%02x", hash[i]);
+}
+
+/* read nr completion records from the cq fd, return how many failed */
+int wait_cq(int fd, int nr)
+{
+	struct jobres res[64];
+	int failed = 0;
+	ssize_t len;
+	int i;
+
+	while (nr > 0) {
+		len = read(fd, res, sizeof(res));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("completion read error");
+			return failed + nr;
+		}
+		for (i = 0; i < len / sizeof(struct jobres); i++) {
+			printf("Job[%d] result: %s, %llu bytes, %.3f ms",
+			       res[i].id, strerror(-res[i].err), res[i].bytes,
+			       res[i].nsecs / 1e6);
+			print_hash(res[i].hash, res[i].hash_len);
+			printf(".\n");
+			if (res[i].err)
+				failed++;
+			nr--;
+		}
+	}
+
+	return failed;
+}
+
+/* submit stdin jobs JOB_BATCH_MAX a syscall, with -F wait for them */
+int submit_batch(struct xargs *args)
+{
+	struct jobdesc *batch;
+	struct jobdesc *desc;
+	char *infile, *outfile;
+	double start = now();
+	int total = 0;
+	int failed = 0;
+	int queued = 0;
+	int eof = 0;
+	int rc;
+	int n;
+	int i;
+
+	batch = calloc(JOB_BATCH_MAX, sizeof(struct jobdesc));
+	if (!batch) {
+		printf("malloc failed\n");
+		return 1;
+	}
+
+	while (!eof) {
+		n = 0;
+		while (n < JOB_BATCH_MAX) {
+			rc = read_job_line(outfile_suffix(args), &infile,
+					   &outfile);
+			if (rc < 0) {
+				eof = 1;
+				break;
+			}
+			total++;
+			if (rc == 0) {
+				failed++;
+				continue;
+			}
+			desc = &batch[n++];
+			desc->infile = infile;
+			desc->outfile = outfile;
+			desc->category = args->category;
+			desc->algo = args->algo;
+			desc->oflags = args->oflags;
+			desc->flags = args->flags & XJOB_F_JOB;
+			desc->level = args->level;
+			desc->priority = args->priority;
+		}
+		if (n == 0)
+			break;
+
+		args->batch_buf = batch;
+		args->batch_len = n;
+		rc = syscall(__NR_xjob, (void *)args, sizeof(struct xargs));
+		if (rc < 0) {
+			perror("batch submit error");
+			failed += n;
+		}
+
+		for (i = 0; i < n; i++) {
+			desc = &batch[i];
+			/* ids and errors are not written back on failure,
+			 * the whole batch is counted failed above */
+			if (rc >= 0 && desc->err) {
+				printf("Job[%d] %s: %s\n", desc->id,
+				       desc->infile, strerror(-desc->err));
+				failed++;
+			} else if (rc >= 0) {
+				printf("Job[%d] submited: %s\n", desc->id,
+				       desc->infile);
+				queued++;
+			}
+			free((void *)desc->infile);
+			free((void *)desc->outfile);
+		}
+		memset(batch, 0, n * sizeof(struct jobdesc));
+	}
+
+	if (args->flags & XJOB_F_CQ)
+		failed += wait_cq(args->cq_fd, queued);
+	print_rate(total, failed, start);
+	free(batch);
+
+	return failed ? 1 : 0;
+}
+
+void ring_enter(struct xargs *args, struct xjob_rings *rings)
+{
+	/* pairs with the poller's barrier after setting sq_flags */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!(__atomic_load_n(&rings->sq_flags, __ATOMIC_ACQUIRE)
+				& RING_NEED_WAKEUP))
+		return;
+
+	args->action = ACTION_RING_ENTER;
+	if (syscall(__NR_xjob, (void *)args, sizeof(struct xargs)) < 0)
+		perror("ring enter error");
+}
+
+/* submit stdin jobs through the shared rings and wait for all of them */
+int submit_ring(struct xargs *args)
+{
+	struct ring_params params;
+	struct xjob_rings *rings;
+	struct xjob_sqe *sqes, *sqe;
+	struct xjob_cqe *cqes, *cqe;
+	struct pollfd pfd;
+	char *infile, *outfile;
+	char **names = NULL; /* infile of each submitted job */
+	int nr_names = 0;
+	void *map;
+	double start = now();
+	unsigned int head, tail;
+	int inflight = 0;
+	int total = 0;
+	int failed = 0;
+	int eof = 0;
+	int fd;
+	int rc;
+
+	memset(&params, 0, sizeof(struct ring_params));
+	params.sq_entries = RING_ENTRIES;
+	args->action = ACTION_RING_SETUP;
+	args->ring_params = &params;
+	fd = syscall(__NR_xjob, (void *)args, sizeof(struct xargs));
+	if (fd < 0) {
+		perror("ring setup error");
+		return 1;
+	}
+	args->ring_fd = fd;
+
+	map = mmap(NULL, params.map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (map == MAP_FAILED) {
+		perror("ring mmap error");
+		close(fd);
+		return 1;
+	}
+	rings = map;
+	sqes = map + params.sq_off;
+	cqes = map + params.cq_off;
+
+	while (!eof || inflight > 0) {
+		/* fill the sq, never more jobs than the cq can hold */
+		tail = rings->sq_tail;
+		while (!eof && inflight < params.cq_entries &&
+		       tail - __atomic_load_n(&rings->sq_head, __ATOMIC_ACQUIRE)
+				< params.sq_entries) {
+			rc = read_job_line(outfile_suffix(args), &infile,
+					   &outfile);
+			if (rc < 0) {
+				eof = 1;
+				break;
+			}
+			if (rc == 0) {
+				failed++;
+				total++;
+				continue;
+			}
+			if (strlen(infile) + strlen(outfile) + 2
+					> RING_PATH_LEN) {
+				printf("%s: %s\n", infile,
+				       strerror(ENAMETOOLONG));
+				failed++;
+				total++;
+				free(infile);
+				free(outfile);
+				continue;
+			}
+			if (nr_names % 1024 == 0) {
+				names = realloc(names, (nr_names + 1024)
+						* sizeof(char *));
+				if (!names) {
+					printf("malloc failed\n");
+					exit(1);
+				}
+			}
+			names[nr_names] = infile;
+
+			sqe = &sqes[tail & (params.sq_entries - 1)];
+			sqe->user_data = nr_names++;
+			sqe->category = args->category;
+			sqe->algo = args->algo;
+			sqe->oflags = args->oflags;
+			sqe->flags = args->flags & XJOB_F_JOB;
+			sqe->level = args->level;
+			sqe->priority = args->priority;
+			sprintf(sqe->paths, "%s%c%s", infile, '\0', outfile);
+			free(outfile);
+			tail++;
+			total++;
+			inflight++;
+		}
+		__atomic_store_n(&rings->sq_tail, tail, __ATOMIC_RELEASE);
+		ring_enter(args, rings);
+
+		/* reap the cq */
+		head = rings->cq_head;
+		if (head == __atomic_load_n(&rings->cq_tail, __ATOMIC_ACQUIRE)) {
+			if (!inflight)
+				continue;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+				perror("ring poll error");
+				break;
+			}
+			continue;
+		}
+		while (head != __atomic_load_n(&rings->cq_tail,
+					       __ATOMIC_ACQUIRE)) {
+			cqe = &cqes[head & (params.cq_entries - 1)];
+			if (cqe->res.err) {
+				printf("Job[%d] %s: %s\n", cqe->res.id,
+				       names[cqe->user_data],
+				       strerror(-cqe->res.err));
+				failed++;
+			} else if (cqe->res.hash_len) {
+				printf("Job[%d] %s", cqe->res.id,
+				       names[cqe->user_data]);
+				print_hash(cqe->res.hash, cqe->res.hash_len);
+				printf("\n");
+			}
+			free(names[cqe->user_data]);
+			names[cqe->user_data] = NULL;
+			head++;
+			inflight--;
+		}
+		__atomic_store_n(&rings->cq_head, head, __ATOMIC_RELEASE);
+		ring_enter(args, rings); /* poller may wait for cq room */
+	}
+
+	print_rate(total, failed, start);
+	munmap(map, params.map_size);
+	close(fd);
+	free(names);
+
+	return failed ? 1 : 0;
+}
+
+/* digest infile the way the module does, and compare it to the digest
+ * in digestfile if there is one */
+int verify(int algo, int tree, char *infile, char *digestfile)
+{
+	struct uhash_ctx root, leaf;
+	unsigned char hash[SHA256_HASH_SIZE];
+	char digest[2 * SHA256_HASH_SIZE + 1];
+	char expect[2 * SHA256_HASH_SIZE + 1];
+	unsigned long long leaf_len = 0;
+	unsigned char *buf, *p;
+	size_t n, len;
+	FILE *fp;
+	int err = 0;
+	int i;
+
+	fp = fopen(infile, "r");
+	if (!fp) {
+		perror("invalid infile");
+		return 1;
+	}
+	buf = malloc(VERIFY_BUF);
+	if (!buf) {
+		printf("malloc failed\n");
+		fclose(fp);
+		return 1;
+	}
+
+	/* root is the whole file digest unless -T */
+	uhash_init(&root, algo);
+	uhash_init(&leaf, algo);
+	while ((n = fread(buf, 1, VERIFY_BUF, fp)) > 0) {
+		if (!tree) {
+			uhash_update(&root, buf, n);
+			continue;
+		}
+		for (p = buf; n > 0; p += len, n -= len) {
+			len = n;
+			if (len > TREE_LEAF_SIZE - leaf_len)
+				len = TREE_LEAF_SIZE - leaf_len;
+			uhash_update(&leaf, p, len);
+			leaf_len += len;
+			if (leaf_len == TREE_LEAF_SIZE) {
+				uhash_final(&leaf, hash);
+				uhash_update(&root, hash, get_hash_size(algo));
+				uhash_init(&leaf, algo);
+				leaf_len = 0;
+			}
+		}
+	}
+	if (ferror(fp)) {
+		perror("read error");
+		err = 1;
+		goto out;
+	}
+	if (leaf_len) {
+		uhash_final(&leaf, hash);
+		uhash_update(&root, hash, get_hash_size(algo));
+	}
+	uhash_final(&root, hash);
+
+	for (i = 0; i < get_hash_size(algo); i++)
+		sprintf(digest + 2 * i, "%02x", hash[i]);
+	if (!digestfile) {
+		printf("%s  %s\n", digest, infile);
+		goto out;
+	}
+
+	fclose(fp);
+	fp = fopen(digestfile, "r");
+	if (!fp) {
+		perror("invalid digest file");
+		err = 1;
+		goto out;
+	}
+	n = fread(expect, 1, get_digest_size(algo), fp);
+	expect[n] = '\0';
+	if (strcmp(digest, expect) == 0) {
+		printf("%s: OK\n", infile);
+	} else {
+		printf("%s: MISMATCH, got %s, %s expected\n", infile, digest,
+		       expect);
+		err = 1;
+	}
+
+out:
+	if (fp)
+		fclose(fp);
+	free(buf);
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
 	int rc;
@@ -77,19 +570,76 @@ int main(int argc, char *argv[])
 	int id = 0;
 	int action = ACTION_SUBMIT;
 	int category = CATEGORY_UNDEFINED;
-	int algo = ALGORITHM_MD5; /* make md5 default hash algo */
+	int algo = -1; /* md5 for checksum, deflate for compress */
+	int level = 0;
+	int decompress = 0;
+	int algo_mask = 0;
+	int priority = PRIORITY_DEFAULT;
 	int block = 1; /* do not wait for the signal */
+	int use_cq = 0;
+	int tree = 0;
+	int no_outfile = 0;
+	pid_t list_pid = 0;
+	unsigned int list_states = 0; /* queued only */
+	int verify_only = 0;
+	int wait_ms = -1; /* for queue room, forever */
+	int intr = 0;
 	char *outfile = NULL;
 	char *infile = NULL;
 
-	while ((ch = getopt(argc, argv, "CLRr:a:hnwo:")) != -1) {
+	while ((ch = getopt(argc, argv, "ABCDFLNP:RS:TUVZa:hil:no:p:r:t:w")) != -1) {
 		switch (ch) {
+		case 'B':
+			action = ACTION_SUBMIT_BATCH;
+			break;
+		case 'U':
+			action = ACTION_RING_SETUP;
+			break;
+		case 'T':
+			tree = 1;
+			break;
+		case 'N':
+			no_outfile = 1;
+			break;
+		case 'V':
+			verify_only = 1;
+			break;
 		case 'C':
 			category = CATEGORY_CHECKSUM;
 			break;
+		case 'Z':
+			category = CATEGORY_COMPRESS;
+			break;
+		case 'D':
+			decompress = 1;
+			break;
+		case 'l':
+			level = strtol(optarg, 0, 10);
+			break;
+		case 'p':
+			for (priority = PRIORITY_LOW; priority < PRIORITY_LAST;
+			     priority++) {
+				if (!strcmp(optarg, get_priority_name(priority)))
+					break;
+			}
+			if (priority == PRIORITY_LAST) {
+				printf("Please specify a valid priority\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'F':
+			use_cq = 1;
+			break;
 		case 'L':
 			action = ACTION_LIST;
 			break;
+		case 'P':
+			list_pid = strtol(optarg, 0, 10);
+			break;
+		case 'A':
+			list_states = ~0U;
+			break;
 		case 'R':
 			action = ACTION_REMOVE_ALL;
 			break;
@@ -97,13 +647,12 @@ int main(int argc, char *argv[])
 			action = ACTION_REMOVE_ONE;
 			id = strtol(optarg, 0, 10);
 			break;
+		case 'S':
+			action = ACTION_STATUS;
+			id = strtol(optarg, 0, 10);
+			break;
 		case 'a':
-			if (strcmp(optarg, "md5") == 0)
-				algo = ALGORITHM_MD5;
-			else if (strcmp(optarg, "sha1") == 0)
-				algo = ALGORITHM_SHA1;
-			else
-				algo = ALGORITHM_UNDEFINED;
+			algo = parse_algos(optarg, &algo_mask);
 			break;
 		case 'o':
 			outfile = get_outfile_path(optarg);
@@ -118,6 +667,12 @@ int main(int argc, char *argv[])
 		case 'n':
 			block = 0;
 			break;
+		case 't':
+			wait_ms = strtol(optarg, 0, 10);
+			break;
+		case 'i':
+			intr = 1;
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -127,15 +682,31 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (algo < 0)
+		algo = category == CATEGORY_COMPRESS ? ALGORITHM_DEFLATE :
+			ALGORITHM_MD5;
+
+	if (verify_only) {
+		if (optind >= argc || algo_mask || get_hash_size(algo) == 0) {
+			usage();
+			exit(1);
+		}
+		err = verify(algo, tree, argv[optind], outfile);
+		free(outfile);
+		return err;
+	}
+
 	/* more validation */
-	if (action == ACTION_SUBMIT && algo == ALGORITHM_UNDEFINED) {
+	if ((action == ACTION_SUBMIT || action == ACTION_SUBMIT_BATCH ||
+	     action == ACTION_RING_SETUP) && algo == ALGORITHM_UNDEFINED) {
 		printf("Please specify a valid algorithm\n");
 		usage();
 		err = 1;
 		goto out;
 	}
 
-	if (action == ACTION_SUBMIT && category == CATEGORY_UNDEFINED) {
+	if ((action == ACTION_SUBMIT || action == ACTION_SUBMIT_BATCH ||
+	     action == ACTION_RING_SETUP) && category == CATEGORY_UNDEFINED) {
 		printf("Please specify a valid category, e.g. -C\n");
 		usage();
 		err = 1;
@@ -144,6 +715,7 @@ int main(int argc, char *argv[])
 
 	/* packing syscall args */
 	struct xargs args;
+	struct jobstatus status;
 	args.id = id;
 	args.infile = NULL;
 	args.outfile = outfile;
@@ -153,6 +725,51 @@ int main(int argc, char *argv[])
 	args.algo = algo;
 	args.list_buf = NULL;
 	args.list_len = 0;
+	args.list_cursor = 0;
+	args.filter.pid = list_pid;
+	args.filter.category = category;
+	args.filter.states = list_states;
+	args.batch_buf = NULL;
+	args.batch_len = 0;
+	args.ring_params = NULL;
+	args.ring_fd = -1;
+	args.flags = tree ? XJOB_F_TREE : 0;
+	if (decompress)
+		args.flags |= XJOB_F_DECOMPRESS;
+	if (algo_mask)
+		args.flags |= XJOB_F_ALGO_MASK;
+	if (no_outfile)
+		args.flags |= XJOB_F_NO_OUTFILE;
+	args.level = level;
+	args.priority = priority;
+	args.cq_fd = -1;
+	args.timeout_ms = wait_ms > 0 ? wait_ms : 0;
+	args.status_buf = action == ACTION_STATUS ? &status : NULL;
+	if (wait_ms == 0)
+		args.flags |= XJOB_F_NONBLOCK;
+	if (intr)
+		args.flags |= XJOB_F_INTR;
+
+	if (use_cq) {
+		args.action = ACTION_CQ_SETUP;
+		rc = syscall(__NR_xjob, (void *)&args, sizeof(struct xargs));
+		if (rc < 0) {
+			perror("completion fd setup error");
+			err = 1;
+			goto out;
+		}
+		args.action = action;
+		args.flags |= XJOB_F_CQ;
+		args.cq_fd = rc;
+	}
+
+	if (action == ACTION_SUBMIT_BATCH) {
+		err = submit_batch(&args);
+		goto out;
+	} else if (action == ACTION_RING_SETUP) {
+		err = submit_ring(&args);
+		goto out;
+	}
 
 	if (optind < argc) {
 		infile = realpath(argv[optind], NULL);
@@ -214,32 +831,74 @@ int main(int argc, char *argv[])
 	}
 
 	if (action == ACTION_LIST) {
-		int i = 0;
+		int total = 0;
+		int i;
 		struct jobent *ent;
-		printf("Job_ID\tPID\tCategory\tInput\n");
-		printf("------\t---\t--------\t-----\n");
-		while (i < args.list_len) {
-			ent = &args.list_buf[i];
-			if (ent->id == 0)
+		printf("Job_ID\tPID\tCategory\tPriority\tState\t\tInput\n");
+		printf("------\t---\t--------\t--------\t-----\t\t-----\n");
+		/* page by id until a short page */
+		for (;;) {
+			for (i = 0; i < rc; i++) {
+				ent = &args.list_buf[i];
+				printf("%d\t%d\t%s\t%s\t\t%-10s\t%s\n",
+				       ent->id, ent->pid,
+				       get_category_name(ent->category),
+				       get_priority_name(ent->priority),
+				       get_state_name(ent->state),
+				       ent->infile);
+			}
+			total += rc;
+			if (rc < args.list_len)
 				break;
-			printf("%d\t%d\t%s\t%s\n", ent->id, ent->pid,
-				get_category_name(ent->category), ent->infile);
-			i++;
+			args.list_cursor = args.list_buf[rc - 1].id + 1;
+			rc = syscall(__NR_xjob, (void *)&args,
+				     sizeof(struct xargs));
+			if (rc < 0) {
+				perror("message");
+				err = 1;
+				goto out;
+			}
 		}
-		printf("Total: %d queued job%s\n", i, i > 1 ? "s" : "");
+		printf("Total: %d job%s\n", total, total != 1 ? "s" : "");
+		goto out;
+	}
+
+	if (action == ACTION_STATUS) {
+		printf("Job[%d]: %s, %llu/%llu bytes", status.id,
+		       get_state_name(status.state), status.bytes,
+		       status.size);
+		if (status.state >= STATE_SUCCESS)
+			printf(", %s", strerror(-status.err));
+		print_hash(status.hash, status.hash_len);
+		printf("\n");
 		goto out;
 	}
 
 	/* waiting for signal */
 	if (action == ACTION_SUBMIT) {
 		printf("Job[%d] submited.\n", args.id);
-		if (block) {
+		if (block && use_cq) {
+			printf("waiting for result...\n");
+			err = wait_cq(args.cq_fd, 1) ? 1 : 0;
+		} else if (block) {
 			/* job may be already completed (job_id >= 0)*/
 			printf("waiting for result...\n");
 			if (job_id < 0)
 				pause(); /* sleep until signal comes */
 			printf("Job[%d] result: %s.\n",
 					job_id, strerror(job_errno));
+			/* the signal has no room for the digest */
+			if (no_outfile && !job_errno) {
+				args.action = ACTION_STATUS;
+				args.status_buf = &status;
+				if (syscall(__NR_xjob, (void *)&args,
+					    sizeof(struct xargs)) == 0) {
+					printf("Job[%d] digest", job_id);
+					print_hash(status.hash,
+						   status.hash_len);
+					printf("\n");
+				}
+			}
 		}
 	} else {
 		printf("syscall returns %d\n", rc);
@@ -1,6 +1,9 @@
 #ifndef _XJOB_H_
 #define _XJOB_H_
 
+#ifdef XJOB_SHIM
+#include "qshim.h"	/* userspace build for qbench.c */
+#else
 #include <linux/linkage.h>
 #include <linux/fs.h>
 #include <linux/namei.h>
@@ -14,6 +17,10 @@
 #include <linux/crypto.h>
 #include <linux/scatterlist.h>
 #include <linux/signal.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/rcupdate.h>
+#endif
 
 #include "common.h"
 
@@ -29,54 +36,176 @@
 	pr_info(fmt "\n", ##__VA_ARGS__)
 #endif
 
-#define Q_MAX_SIZE 5
+#define Q_MAX_SIZE 5 /* default qmax */
+#define CONSUMER_MAX 256 /* num_consumer */
+/* in+out paths up to this size come from the path cache, else kmalloc */
+#define PATH_CACHE_SIZE 256
+/* a large and a small lane per priority, in the order they are served */
+#define LANE_LARGE 0
+#define LANE_SMALL 1
+#define NR_LANES ((PRIORITY_LAST - PRIORITY_LOW) * 2)
+#define LANE(priority, size) (((priority) - PRIORITY_LOW) * 2 + (size))
+
+/* job->cancel, set by removal while the job is processed */
+#define CANCEL_JOB 1
+#define CANCEL_ALL 2	/* and the jobs coalesced with it */
 
-enum job_state_class {
-	STATE_NEW,
-	STATE_PENDING,
-	STATE_PROCESSING,
-	STATE_SUCCESS,
-	STATE_ABORTE,
-	STATE_FAILED,
+/* on the incoming stack of a job queue, pushed with cmpxchg() and taken
+ * whole with xchg(). not linux/llist.h: llist_add_batch() is only built
+ * with CONFIG_LLIST */
+struct push_node {
+	struct push_node *next;
 };
 
+struct xring;
+struct xcq;
+struct cq_rec;
+struct eventfd_ctx;
+struct proc_dir_entry;
+
 struct job {
 	int id;
 	pid_t pid;
 	int state;
+	int err;		/* once finished */
 	unsigned int category;
 	unsigned int algo;
 	unsigned int oflags;
-	const char *infile;
+	unsigned int flags;	/* XJOB_F_JOB */
+	int level;		/* of compression */
+	unsigned int priority;
+	int lane;		/* LANE(), raised by aging */
+	unsigned long queued_at; /* jiffies, when it entered its lane */
+	loff_t size;		/* of infile when submitted, 0 if unknown */
+	const char *infile;	/* both point into paths */
 	const char *outfile;
+	char *paths;
+	unsigned int paths_len;
+	struct list_head list;	/* in its job queue, followers or running */
+	struct push_node push;	/* on the incoming stack of its job queue */
+	struct jqueue *jq;	/* queued on, under its lock */
+	struct xring *ring;	/* submitted through a ring, holds a ref */
+	u64 user_data;		/* of the ring sqe */
+	struct xcq *cq;		/* XJOB_F_CQ, hold a ref */
+	struct cq_rec *cq_rec;	/* its completion record, allocated ahead */
+	struct eventfd_ctx *efd;
+	ktime_t submit_time;
+	ktime_t start_time;	/* dequeued */
+	u64 bytes;		/* of infile processed */
+	u8 hash[HASH_ALL_SIZE];	/* digests of infile, in algorithm order */
+	unsigned int hash_len;	/* of hash once hashed, 0 before */
+	int cancel;		/* CANCEL_*, checked between chunks */
+	struct hlist_node flight; /* leads identical jobs, see flight.c */
+	struct list_head followers;
+	bool following;		/* on a leader's followers, under flight_lock */
+	struct rcu_head rcu;	/* freed once no listing can read it */
+};
+
+/* one job queue per cpu, idle consumers steal from the others.
+ * FIFO lanes, the highest non-empty lane is served first. with
+ * incoming_push, producers push to incoming without the lock, the jobs
+ * move to their lanes when the lock is next taken */
+struct jqueue {
+	struct mutex lock; /* protect this queue but incoming */
+	struct push_node *incoming; /* newest first */
+	struct list_head lanes[NR_LANES];
+	int nr[NR_LANES];
+	int len;
 };
 
-struct queue {
-	struct job *job;
-	struct queue *next;
+/* identity and version of an infile, for the checksum result cache */
+struct file_stamp {
+	struct super_block *sb;
+	dev_t dev;		/* of sb, which a later mount may reuse */
+	unsigned long ino;
+	u32 generation;
+	loff_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+	u64 version;
+	bool racy;		/* changed too recently to be cached */
 };
 
 asmlinkage extern long (*sysptr)(__user void *args, int argslen);
 extern int consume(void *);
-extern int produce(struct job *);
-extern void add2queue(struct queue *);
-extern struct queue *remove_first_job(void);
-extern struct queue *remove_job(int id);
+extern int reserve_slots(int nr);
+extern void release_slot(void);
+extern struct jqueue *local_queue(void);
+extern struct job *dequeue_job(int cid);
+extern void flush_queues(void);
+extern int produce(struct job *, unsigned int flags, unsigned int timeout_ms);
+extern int produce_batch(struct job **, int nr, unsigned int flags,
+			 unsigned int timeout_ms, int *queued);
+extern void enqueue_jobs(struct jqueue *, struct job **, int nr);
+extern void add2queue(struct jqueue *, struct job *);
+extern struct job *remove_first_job(struct jqueue *);
+extern bool remove_job(struct jqueue *, struct job *);
+extern struct job *alloc_job(void);
+extern int init_job(struct job *, struct jobdesc *);
+extern void stat_infile(struct job *);
 extern void destroy_job(struct job *);
+extern void discard_job(struct job *);
+extern void cancel_running(void);
+extern int new_job_ids(int nr);
 extern void check(struct job *);
-extern int checksum(int, const char *, const char *, int);
+extern void notify_user(struct job *, int err, int cid);
+extern int process_job(struct job *, int cid);
+extern void fill_jobres(struct job *, int err, struct jobres *);
+extern int checksum(struct job *);
+extern int checksum_follow(struct job *, struct job *leader);
+extern int compress(struct job *);
+extern int codec_supported(unsigned int algo, bool decompress);
+extern bool hash_tree_leaf(void);
+extern bool tree_pending(void);
+extern int ring_setup(__user struct ring_params *);
+extern int ring_enter(int fd);
+extern void ring_complete(struct job *, int err);
+extern void ring_put(struct xring *);
+extern int cq_setup(void);
+extern int cq_get(int fd, struct xcq **, struct eventfd_ctx **);
+extern void cq_release(struct xcq *, struct eventfd_ctx *);
+extern int cq_bind(struct job *, struct xcq *, struct eventfd_ctx *);
+extern void cq_unbind(struct job *);
+extern void cq_complete(struct job *, int err);
+extern bool flight_join(struct job *);
+extern void flight_lead(struct job *);
+extern void flight_end(struct job *, struct list_head *followers);
+extern struct job *flight_promote(struct job *);
+extern bool flight_detach(struct job *);
+extern void index_jobs(struct job **, int nr);
+extern bool unindex_job(struct job *);
+extern struct job *lookup_job(int id);
+extern int list_jobs(__user struct jobent *, int len, unsigned int cursor,
+		     struct jobfilter *);
+extern int job_status(int id, __user struct jobstatus *);
+extern bool get_file_stamp(struct inode *, struct file_stamp *);
+extern bool cache_lookup(struct file_stamp *, unsigned int algo,
+			 unsigned int flags, u8 *hash);
+extern void cache_insert(struct file_stamp *, unsigned int algo,
+			 unsigned int flags, const u8 *hash);
+extern int init_cache(void);
+extern void destroy_cache(void);
+extern void stat_job(struct job *, int cid);
+extern void stat_busy(int cid, ktime_t start);
+extern void stat_consumer_start(int cid);
+extern void stat_qlen(int len);
+extern void stat_producer_block(void);
+extern int init_stats(void);
+extern void destroy_stats(void);
 
 /* global shared variables */
-extern struct queue *head, *tail;
-extern struct mutex qmutex; /* protect job queue & wait queue */
-extern int qlen;
+extern struct jqueue *jqueues;
+extern int nr_jqueues;
+extern atomic_t qlen; /* jobs queued or being queued, over all queues */
 extern int qmax;
+extern unsigned int incoming_push;
 extern wait_queue_head_t pwq;
 extern wait_queue_head_t cwq;
 extern int num_consumer;
 extern struct task_struct **cthreads;
 extern bool should_stop;
 extern unsigned int curr_id;
+extern struct proc_dir_entry *proc_xjob; /* /proc/xjob */
 
 #endif	/* not _XJOB_H_ */
 
@@ -0,0 +1,86 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xjob
+
+#if !defined(_XJOB_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _XJOB_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* the life of a job, in /sys/kernel/debug/tracing/events/xjob */
+DECLARE_EVENT_CLASS(xjob_job,
+
+	TP_PROTO(struct job *job, int err),
+
+	TP_ARGS(job, err),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(pid_t, pid)
+		__field(unsigned int, category)
+		__field(unsigned int, algo)
+		__field(loff_t, size)
+		__field(int, err)
+	),
+
+	TP_fast_assign(
+		__entry->id = job->id;
+		__entry->pid = job->pid;
+		__entry->category = job->category;
+		__entry->algo = job->algo;
+		__entry->size = job->size;
+		__entry->err = err;
+	),
+
+	TP_printk("id=%d pid=%d category=%s algo=%#x size=%lld err=%d",
+		  __entry->id, __entry->pid,
+		  __print_symbolic(__entry->category,
+				   {CATEGORY_CHECKSUM, "checksum"},
+				   {CATEGORY_COMPRESS, "compress"}),
+		  __entry->algo, __entry->size, __entry->err)
+);
+
+/* accepted by ACTION_SUBMIT, ACTION_SUBMIT_BATCH or a ring */
+DEFINE_EVENT(xjob_job, xjob_submit,
+	TP_PROTO(struct job *job, int err),
+	TP_ARGS(job, err)
+);
+
+/* on a job queue, jobs coalesced with a pending one are not */
+DEFINE_EVENT(xjob_job, xjob_enqueue,
+	TP_PROTO(struct job *job, int err),
+	TP_ARGS(job, err)
+);
+
+/* the queue is full, the producer of job goes to sleep */
+DEFINE_EVENT(xjob_job, xjob_producer_block,
+	TP_PROTO(struct job *job, int err),
+	TP_ARGS(job, err)
+);
+
+DEFINE_EVENT(xjob_job, xjob_dequeue,
+	TP_PROTO(struct job *job, int err),
+	TP_ARGS(job, err)
+);
+
+DEFINE_EVENT(xjob_job, xjob_process_start,
+	TP_PROTO(struct job *job, int err),
+	TP_ARGS(job, err)
+);
+
+DEFINE_EVENT(xjob_job, xjob_process_end,
+	TP_PROTO(struct job *job, int err),
+	TP_ARGS(job, err)
+);
+
+DEFINE_EVENT(xjob_job, xjob_notify,
+	TP_PROTO(struct job *job, int err),
+	TP_ARGS(job, err)
+);
+
+#endif	/* not _XJOB_TRACE_H */
+
+/* outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE xjob_trace
+#include <trace/define_trace.h>